@@ -0,0 +1,640 @@
+// Deterministic concurrency simulator shared by both programs.
+//
+// Under a sim::Scheduler every spawned task runs on its own thread, but only
+// one task holds the baton at a time. Tasks hand the baton over at lock,
+// condition-variable and sleep points, and a seeded PRNG picks who runs
+// next, so one seed always reproduces the same interleaving. Time is
+// virtual: every scheduling point costs STEP_NS, and sleeps jump the clock
+// forward instead of waiting.
+//
+// sim::Mutex, sim::SharedMutex and sim::CondVar are drop-in replacements for
+// the std types. Called from a thread that is not a sim task they simply
+// forward to the real primitives, so the same code runs normally outside a
+// simulation. A primitive must not be shared between sim tasks and real
+// threads while a simulation is running.
+
+#ifndef DETERMINISTIC_SIM_H
+#define DETERMINISTIC_SIM_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sim
+{
+
+class Scheduler
+{
+public:
+    static constexpr uint64_t STEP_NS   = 1000;        // virtual cost of one scheduling point
+    static constexpr uint64_t MAX_STEPS = 2000000;     // treated as a livelock past this
+
+    explicit Scheduler(uint64_t seed, bool trace = false)
+        : rng(seed), tracing(trace)
+    {
+    }
+
+    ~Scheduler()
+    {
+        for (auto &t : tasks)
+            if (t->th.joinable())
+                t->th.join();
+    }
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    void spawn(const std::string &name, std::function<void()> body)
+    {
+        auto t  = std::make_unique<Task>();
+        t->id   = static_cast<int>(tasks.size());
+        t->name = name;
+        t->body = std::move(body);
+        tasks.push_back(std::move(t));
+    }
+
+    // Runs every task to completion. False on deadlock or livelock; the
+    // tasks still blocked are then unwound one at a time.
+    bool run()
+    {
+        for (auto &t : tasks)
+            t->th = std::thread(&Scheduler::taskMain, this, t.get());
+
+        handOff(pickNext(), MAIN);
+
+        if (!failed.empty())
+        {
+            aborting = true;
+            for (auto &t : tasks)
+                if (t->state != State::Done)
+                    handOff(t->id, MAIN);
+        }
+
+        for (auto &t : tasks)
+            t->th.join();
+        return failed.empty();
+    }
+
+    uint64_t                        now() const     { return clock; }
+    uint64_t                        steps() const   { return stepCount; }
+    const std::string              &failure() const { return failed; }
+    const std::vector<std::string> &trace() const   { return events; }
+
+    // The scheduler driving the calling thread, or null outside a simulation
+    static Scheduler *active() { return self().sched; }
+
+    // Preemption point around an acquisition; taken both before it and
+    // once it succeeds, so a task can also be switched out while holding
+    void point(const char *what)
+    {
+        if (aborting)
+            throw Abort{};
+        if (++stepCount > MAX_STEPS)
+        {
+            fail("step limit reached (livelock?)");
+            reschedule(what);
+            return;
+        }
+        clock += STEP_NS;
+        reschedule(what);
+    }
+
+    // Mark the caller as waiting on obj without giving up the baton yet;
+    // the next reschedule() parks it until wake() is called for obj
+    void park(const void *obj)
+    {
+        Task &t     = current();
+        t.state     = State::Blocked;
+        t.waitingOn = obj;
+    }
+
+    // park() with a virtual deadline; see timedOut()
+    void parkUntil(const void *obj, uint64_t when)
+    {
+        park(obj);
+        Task &t    = current();
+        t.timed    = true;
+        t.wakeAt   = when;
+        t.timedOut = false;
+    }
+
+    // Whether the caller's last timed park ended by its deadline
+    bool timedOut() { return current().timedOut; }
+
+    void block(const void *obj, const char *what)
+    {
+        park(obj);
+        reschedule(what);
+    }
+
+    void sleepUntil(uint64_t when)
+    {
+        Task &t  = current();
+        t.state  = State::Sleeping;
+        t.wakeAt = when;
+        reschedule("sleep");
+    }
+
+    // Make tasks waiting on obj runnable; one picks a random waiter
+    void wake(const void *obj, bool all)
+    {
+        std::vector<Task *> waiting;
+        for (auto &t : tasks)
+            if (t->state == State::Blocked && t->waitingOn == obj)
+                waiting.push_back(t.get());
+        if (waiting.empty())
+            return;
+
+        if (!all)
+            waiting = {waiting[rng.next() % waiting.size()]};
+        for (Task *t : waiting)
+        {
+            t->state     = State::Runnable;
+            t->waitingOn = nullptr;
+            t->timed     = false;
+        }
+    }
+
+    // Give up the baton after park(); a no-op if something woke the caller
+    void reschedule(const char *what)
+    {
+        if (aborting)
+        {
+            if (current().state != State::Runnable)
+                throw Abort{};
+            return;
+        }
+
+        int me   = self().id;
+        int next = failed.empty() ? pickNext() : -1;
+        if (next < 0)
+        {
+            if (failed.empty())
+                fail(std::string("deadlock: ") + describeBlocked());
+            handOff(MAIN, me);
+            if (aborting)
+                throw Abort{};
+            return;
+        }
+        if (next == me)
+            return;
+
+        if (tracing)
+        {
+            std::ostringstream os;
+            os << std::setw(10) << clock / 1000 << " us  " << tasks[me]->name << " -> "
+               << tasks[next]->name << "  (" << what << ")";
+            events.push_back(os.str());
+        }
+        handOff(next, me);
+        if (aborting)
+            throw Abort{};
+    }
+
+private:
+    static constexpr int MAIN = -1;
+
+    enum class State { Runnable, Blocked, Sleeping, Done };
+
+    struct Task
+    {
+        int                   id = 0;
+        std::string           name;
+        std::function<void()> body;
+        State                 state     = State::Runnable;
+        const void           *waitingOn = nullptr;
+        uint64_t              wakeAt    = 0;       // Sleeping, or Blocked with timed set
+        bool                  timed     = false;
+        bool                  timedOut  = false;
+        std::thread           th;
+    };
+
+    // Thrown out of a wait point when the run is being torn down
+    struct Abort {};
+
+    struct Binding
+    {
+        Scheduler *sched = nullptr;
+        int        id    = MAIN;
+    };
+
+    // splitmix64
+    struct Rng
+    {
+        uint64_t s;
+        explicit Rng(uint64_t seed) : s(seed) {}
+        uint64_t next()
+        {
+            uint64_t z = (s += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+    };
+
+    static Binding &self()
+    {
+        thread_local Binding b;
+        return b;
+    }
+
+    Task &current() { return *tasks[self().id]; }
+
+    void taskMain(Task *t)
+    {
+        self() = {this, t->id};
+        {
+            std::unique_lock<std::mutex> lk(batonMutex);
+            batonCv.wait(lk, [&]() { return running == t->id; });
+        }
+
+        if (!aborting)
+        {
+            try
+            {
+                t->body();
+            }
+            catch (const Abort &)
+            {
+            }
+        }
+
+        t->state = State::Done;
+        int next = aborting || !failed.empty() ? MAIN : pickNext();
+        if (next < 0 && !allDone() && failed.empty())
+            fail(std::string("deadlock: ") + describeBlocked());
+
+        std::lock_guard<std::mutex> lk(batonMutex);
+        running = next < 0 ? MAIN : next;
+        batonCv.notify_all();
+    }
+
+    // Pass the baton to `to` and wait until it comes back to `me`
+    void handOff(int to, int me)
+    {
+        std::unique_lock<std::mutex> lk(batonMutex);
+        running = to;
+        batonCv.notify_all();
+        batonCv.wait(lk, [&]() { return running == me; });
+    }
+
+    static bool hasDeadline(const Task &t)
+    {
+        return t.state == State::Sleeping || (t.state == State::Blocked && t.timed);
+    }
+
+    // Random runnable task; when none is runnable the clock jumps to the
+    // earliest sleeper or timed waiter. -1 when every live task is blocked
+    // for good (or all are done).
+    int pickNext()
+    {
+        std::vector<int> ready;
+        for (auto &t : tasks)
+            if (t->state == State::Runnable)
+                ready.push_back(t->id);
+
+        if (ready.empty())
+        {
+            uint64_t earliest = UINT64_MAX;
+            for (auto &t : tasks)
+                if (hasDeadline(*t))
+                    earliest = std::min(earliest, t->wakeAt);
+            if (earliest == UINT64_MAX)
+                return -1;
+
+            clock = std::max(clock, earliest);
+            for (auto &t : tasks)
+                if (hasDeadline(*t) && t->wakeAt <= clock)
+                {
+                    t->timedOut  = t->state == State::Blocked;
+                    t->state     = State::Runnable;
+                    t->waitingOn = nullptr;
+                    t->timed     = false;
+                    ready.push_back(t->id);
+                }
+        }
+
+        return ready[rng.next() % ready.size()];
+    }
+
+    bool allDone() const
+    {
+        for (auto &t : tasks)
+            if (t->state != State::Done)
+                return false;
+        return true;
+    }
+
+    std::string describeBlocked() const
+    {
+        std::string out;
+        for (auto &t : tasks)
+            if (t->state == State::Blocked)
+                out += (out.empty() ? "" : ", ") + t->name;
+        return out + " blocked";
+    }
+
+    void fail(const std::string &why)
+    {
+        if (failed.empty())
+            failed = why;
+    }
+
+    std::vector<std::unique_ptr<Task>> tasks;
+    Rng                                rng;
+    bool                               tracing;
+    std::vector<std::string>           events;
+    uint64_t                           clock     = 0;
+    uint64_t                           stepCount = 0;
+    std::string                        failed;
+    bool                               aborting  = false;
+
+    std::mutex                         batonMutex;
+    std::condition_variable            batonCv;
+    int                                running = MAIN;
+};
+
+// Virtual nanoseconds inside a simulation, steady-clock nanoseconds outside
+inline uint64_t nowNs()
+{
+    if (Scheduler *s = Scheduler::active())
+        return s->now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <class Rep, class Period>
+void sleepFor(const std::chrono::duration<Rep, Period> &d)
+{
+    if (Scheduler *s = Scheduler::active())
+        s->sleepUntil(s->now() + std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    else
+        std::this_thread::sleep_for(d);
+}
+
+class Mutex
+{
+public:
+    void lock()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+        {
+            real.lock();
+            return;
+        }
+        s->point("lock");
+        while (held)
+            s->block(this, "lock");
+        held = true;
+        s->point("locked");
+    }
+
+    bool try_lock()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+            return real.try_lock();
+        s->point("try_lock");
+        if (held)
+            return false;
+        held = true;
+        s->point("locked");
+        return true;
+    }
+
+    void unlock()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+        {
+            real.unlock();
+            return;
+        }
+        held = false;
+        s->wake(this, true);
+    }
+
+private:
+    std::mutex real;
+    bool       held = false;
+};
+
+class SharedMutex
+{
+public:
+    void lock()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+        {
+            real.lock();
+            return;
+        }
+        s->point("lock");
+        while (writer || readers > 0)
+            s->block(this, "lock");
+        writer = true;
+        s->point("locked");
+    }
+
+    bool try_lock()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+            return real.try_lock();
+        s->point("try_lock");
+        if (writer || readers > 0)
+            return false;
+        writer = true;
+        s->point("locked");
+        return true;
+    }
+
+    void unlock()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+        {
+            real.unlock();
+            return;
+        }
+        writer = false;
+        s->wake(this, true);
+    }
+
+    void lock_shared()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+        {
+            real.lock_shared();
+            return;
+        }
+        s->point("lock_shared");
+        while (writer)
+            s->block(this, "lock_shared");
+        ++readers;
+        s->point("locked_shared");
+    }
+
+    bool try_lock_shared()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+            return real.try_lock_shared();
+        s->point("try_lock_shared");
+        if (writer)
+            return false;
+        ++readers;
+        s->point("locked_shared");
+        return true;
+    }
+
+    void unlock_shared()
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+        {
+            real.unlock_shared();
+            return;
+        }
+        if (--readers == 0)
+            s->wake(this, true);
+    }
+
+private:
+    std::shared_mutex real;
+    bool              writer  = false;
+    int               readers = 0;
+};
+
+// condition_variable_any over any of the lockables above
+class CondVar
+{
+public:
+    template <class Lock>
+    void wait(Lock &lk)
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+        {
+            real.wait(lk);
+            return;
+        }
+        // registered before the unlock, so a notify in between is not lost
+        s->park(this);
+        lk.unlock();
+        s->reschedule("wait");
+        lk.lock();
+    }
+
+    template <class Lock, class Pred>
+    void wait(Lock &lk, Pred pred)
+    {
+        while (!pred())
+            wait(lk);
+    }
+
+    // False on timeout. Under a simulation the timeout runs in virtual time.
+    template <class Lock, class Rep, class Period>
+    bool wait_for(Lock &lk, const std::chrono::duration<Rep, Period> &d)
+    {
+        Scheduler *s = Scheduler::active();
+        if (!s)
+            return real.wait_for(lk, d) == std::cv_status::no_timeout;
+
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        s->parkUntil(this, s->now() + ns);
+        lk.unlock();
+        s->reschedule("wait_for");
+        lk.lock();
+        return !s->timedOut();
+    }
+
+    // Real deadlines only map onto virtual time approximately (via the
+    // remaining duration), so simulated code should prefer wait_for
+    template <class Lock, class Clock, class Duration>
+    bool wait_until(Lock &lk, const std::chrono::time_point<Clock, Duration> &t)
+    {
+        if (!Scheduler::active())
+            return real.wait_until(lk, t) == std::cv_status::no_timeout;
+        return wait_for(lk, std::max<typename Clock::duration>(t - Clock::now(), Clock::duration::zero()));
+    }
+
+    void notify_one()
+    {
+        if (Scheduler *s = Scheduler::active())
+            s->wake(this, false);
+        else
+            real.notify_one();
+    }
+
+    void notify_all()
+    {
+        if (Scheduler *s = Scheduler::active())
+            s->wake(this, true);
+        else
+            real.notify_all();
+    }
+
+private:
+    std::condition_variable_any real;
+};
+
+// Per-operation latency samples collected across schedules
+class OpStats
+{
+public:
+    void record(const std::string &op, uint64_t ns)
+    {
+        std::lock_guard<std::mutex> lk(statsMutex);
+        samples[op].push_back(ns);
+    }
+
+    void print(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lk(statsMutex);
+        constexpr int OP_W = 16, N_W = 9, US_W = 11;
+        out << std::left << std::setw(OP_W) << "Op" << std::right
+            << std::setw(N_W) << "Count"
+            << std::setw(US_W) << "p50 us" << std::setw(US_W) << "p95 us"
+            << std::setw(US_W) << "p99 us" << std::setw(US_W) << "max us" << "\n";
+        out << std::string(OP_W + N_W + 4 * US_W, '-') << "\n"
+            << std::fixed << std::setprecision(1);
+
+        for (auto &[name, lat] : samples)
+        {
+            std::sort(lat.begin(), lat.end());
+            auto pct = [&](double q)
+            {
+                return lat[std::min(lat.size() - 1, size_t(q * lat.size()))] / 1e3;
+            };
+            out << std::left << std::setw(OP_W) << name << std::right
+                << std::setw(N_W) << lat.size()
+                << std::setw(US_W) << pct(0.50) << std::setw(US_W) << pct(0.95)
+                << std::setw(US_W) << pct(0.99) << std::setw(US_W) << lat.back() / 1e3 << "\n";
+        }
+        out << std::flush;
+    }
+
+private:
+    std::mutex                                   statsMutex;
+    std::map<std::string, std::vector<uint64_t>> samples;
+};
+
+} // namespace sim
+
+#endif // DETERMINISTIC_SIM_H
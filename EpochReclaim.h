@@ -0,0 +1,383 @@
+// Safe memory reclamation for lock-free readers, shared by both programs.
+//
+// A writer that unlinks an object hands it to Domain::retire() instead of
+// deleting it. The object is freed once no reader can still hold it.
+// Readers protect what they touch in one of two ways:
+//
+//   reclaim::Domain::Guard g(domain);         epoch section: cheap and nestable,
+//                                             covers every object reached inside it
+//   reclaim::Hazard<T> h(domain, atomicPtr);  hazard pointer: protects only the
+//                                             object it loaded, for long readers
+//
+// Epoch sections must stay short (a lookup, a probe run): a reader parked
+// inside one holds back everything retired after it entered. Readers that
+// may block, print or wait for input protect their one object with a Hazard
+// instead, which never holds back the epoch. That keeps memory bounded: at
+// most MAX_THREADS * HAZARDS objects are pinned by hazards, and the rest is
+// freed as soon as the short sections in flight have ended. When a thread
+// runs out of hazard slots, Hazard falls back to an epoch section.
+//
+// Retired objects go on the retiring thread's own list, so retire() takes
+// no lock; every few retirements the thread frees what is safe.
+// Lists left behind by exiting threads are adopted by the next collector.
+
+#ifndef EPOCH_RECLAIM_H
+#define EPOCH_RECLAIM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace reclaim
+{
+
+class Domain;
+
+namespace detail
+{
+
+// Small per-thread index into every domain's thread records; recycled
+// when a thread exits, after its retired lists were handed to the domains
+class Threads
+{
+public:
+    static constexpr int MAX_THREADS = 256;
+
+    static Threads &get()
+    {
+        static Threads t;
+        return t;
+    }
+
+    static int slot()
+    {
+        thread_local Registration reg;
+        return reg.slot;
+    }
+
+    void add(Domain *d)
+    {
+        std::lock_guard<std::mutex> lk(threadsMutex);
+        domains.push_back(d);
+    }
+
+    void remove(Domain *d)
+    {
+        std::lock_guard<std::mutex> lk(threadsMutex);
+        domains.erase(std::remove(domains.begin(), domains.end(), d), domains.end());
+    }
+
+    struct Registration
+    {
+        int slot = -1;
+        Registration();
+        ~Registration();
+    };
+
+private:
+    std::mutex           threadsMutex;
+    std::vector<Domain *> domains;
+    std::atomic<bool>    inUse[MAX_THREADS]{};
+};
+
+} // namespace detail
+
+class Domain
+{
+public:
+    static constexpr int    MAX_THREADS   = detail::Threads::MAX_THREADS;
+    static constexpr int    HAZARDS       = 4;    // hazard slots per thread
+    static constexpr size_t COLLECT_EVERY = 64;   // default retirements between collections
+
+    // Epoch read-side section; nests within a thread
+    class Guard
+    {
+    public:
+        explicit Guard(Domain &d) : domain(d), slot(detail::Threads::slot())
+        {
+            Record &r = domain.records[slot];
+            if (r.depth++ == 0)
+            {
+                r.epoch.store(domain.globalEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        ~Guard()
+        {
+            Record &r = domain.records[slot];
+            if (--r.depth == 0)
+                r.epoch.store(0, std::memory_order_release);
+        }
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+    private:
+        Domain &domain;
+        int     slot;
+    };
+
+    // Large retired objects want a small collectEvery
+    explicit Domain(size_t collectEvery = COLLECT_EVERY) : collectEvery(collectEvery)
+    {
+        detail::Threads::get().add(this);
+    }
+
+    // No reader or writer may still be using the domain
+    ~Domain()
+    {
+        detail::Threads::get().remove(this);
+        for (auto &r : records)
+            freeAll(r.retired);
+        std::vector<Retired> left;
+        adopt(left);
+        freeAll(left);
+    }
+
+    Domain(const Domain &) = delete;
+    Domain &operator=(const Domain &) = delete;
+
+    // p is already unreachable for new readers
+    template <class T>
+    void retire(T *p)
+    {
+        retire(const_cast<void *>(static_cast<const void *>(p)),
+               [](void *q) { delete static_cast<T *>(q); });
+    }
+
+    void retire(void *p, void (*deleter)(void *))
+    {
+        Record &r = records[detail::Threads::slot()];
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        r.retired.push_back({p, deleter, globalEpoch.fetch_add(1)});
+        r.pendingCount.store(r.retired.size(), std::memory_order_relaxed);
+        if (++r.sinceCollect >= collectEvery)
+            collect(r);
+    }
+
+    // Free what the calling thread retired (plus adopted orphans) if safe
+    void collect() { collect(records[detail::Threads::slot()]); }
+
+    // Retired but not yet freed, over all threads; approximate while running
+    size_t pending()
+    {
+        size_t n = 0;
+        for (auto &r : records)
+            n += r.pendingCount.load(std::memory_order_relaxed);
+        return n + orphanCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    template <class T>
+    friend class Hazard;
+    friend struct detail::Threads::Registration;
+
+    struct Retired
+    {
+        void    *p;
+        void   (*deleter)(void *);
+        uint64_t epoch;   // freed once every reader entered after this
+    };
+
+    struct alignas(64) Record
+    {
+        std::atomic<uint64_t>     epoch{0};   // 0 = not in an epoch section
+        std::atomic<const void *> hazards[HAZARDS]{};
+        // Below: only the owning thread
+        int                       depth       = 0;
+        unsigned                  hazardsUsed = 0;   // bitmask
+        size_t                    sinceCollect = 0;
+        std::vector<Retired>      retired;
+        std::atomic<size_t>       pendingCount{0};
+    };
+
+    // Retired lists of exited threads, pushed and taken whole without a lock
+    struct Orphans
+    {
+        std::vector<Retired> items;
+        Orphans             *next;
+    };
+
+    // Free everything retired before the oldest epoch still being read
+    // that no hazard points to
+    void collect(Record &own)
+    {
+        own.sinceCollect = 0;
+        if (orphans.load(std::memory_order_relaxed))
+            adopt(own.retired);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t                  oldest = std::numeric_limits<uint64_t>::max();
+        std::vector<const void *> protectedPtrs;
+        for (auto &r : records)
+        {
+            uint64_t e = r.epoch.load(std::memory_order_acquire);
+            if (e != 0)
+                oldest = std::min(oldest, e);
+            for (auto &h : r.hazards)
+                if (const void *p = h.load(std::memory_order_acquire))
+                    protectedPtrs.push_back(p);
+        }
+        std::sort(protectedPtrs.begin(), protectedPtrs.end());
+
+        auto keep = std::partition(own.retired.begin(), own.retired.end(), [&](const Retired &x) {
+            return x.epoch >= oldest || std::binary_search(protectedPtrs.begin(), protectedPtrs.end(), x.p);
+        });
+        for (auto it = keep; it != own.retired.end(); ++it)
+            it->deleter(it->p);
+        own.retired.erase(keep, own.retired.end());
+        own.pendingCount.store(own.retired.size(), std::memory_order_relaxed);
+    }
+
+    // The thread in `slot` is exiting
+    void orphan(int slot)
+    {
+        Record &r = records[slot];
+        r.sinceCollect = 0;
+        if (r.retired.empty())
+            return;
+        orphanCount.fetch_add(r.retired.size(), std::memory_order_relaxed);
+        auto *batch = new Orphans{std::move(r.retired), orphans.load(std::memory_order_relaxed)};
+        r.retired.clear();
+        r.pendingCount.store(0, std::memory_order_relaxed);
+        while (!orphans.compare_exchange_weak(batch->next, batch, std::memory_order_release,
+                                              std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void adopt(std::vector<Retired> &into)
+    {
+        for (Orphans *b = orphans.exchange(nullptr, std::memory_order_acquire); b;)
+        {
+            into.insert(into.end(), b->items.begin(), b->items.end());
+            orphanCount.fetch_sub(b->items.size(), std::memory_order_relaxed);
+            Orphans *next = b->next;
+            delete b;
+            b = next;
+        }
+    }
+
+    static void freeAll(std::vector<Retired> &list)
+    {
+        for (auto &x : list)
+            x.deleter(x.p);
+        list.clear();
+    }
+
+    const size_t           collectEvery;
+    std::atomic<uint64_t>  globalEpoch{1};
+    Record                 records[MAX_THREADS];
+    std::atomic<Orphans *> orphans{nullptr};
+    std::atomic<size_t>    orphanCount{0};
+};
+
+// Loads *src and keeps the object it points to alive until destruction,
+// without holding back the epoch. Falls back to an epoch section when the
+// thread's hazard slots are all taken.
+template <class T>
+class Hazard
+{
+public:
+    Hazard(Domain &d, const std::atomic<T *> &src) : domain(d), slot(detail::Threads::slot())
+    {
+        Domain::Record &r = domain.records[slot];
+        for (int i = 0; i < Domain::HAZARDS; ++i)
+        {
+            if (!(r.hazardsUsed & (1u << i)))
+            {
+                index = i;
+                break;
+            }
+        }
+
+        if (index < 0)
+        {
+            fallback = new (storage) Domain::Guard(domain);
+            ptr      = src.load(std::memory_order_acquire);
+            return;
+        }
+
+        r.hazardsUsed |= 1u << index;
+        std::atomic<const void *> &h = r.hazards[index];
+        T *p = src.load(std::memory_order_acquire);
+        for (;;)
+        {
+            h.store(p, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            T *again = src.load(std::memory_order_acquire);
+            if (again == p)
+                break;
+            p = again;
+        }
+        ptr = p;
+    }
+
+    ~Hazard()
+    {
+        if (fallback)
+        {
+            fallback->~Guard();
+            return;
+        }
+        Domain::Record &r = domain.records[slot];
+        r.hazards[index].store(nullptr, std::memory_order_release);
+        r.hazardsUsed &= ~(1u << index);
+    }
+
+    Hazard(const Hazard &) = delete;
+    Hazard &operator=(const Hazard &) = delete;
+
+    T *get() const { return ptr; }
+    T *operator->() const { return ptr; }
+    T &operator*() const { return *ptr; }
+
+private:
+    Domain        &domain;
+    int            slot;
+    int            index    = -1;
+    T             *ptr      = nullptr;
+    Domain::Guard *fallback = nullptr;
+    alignas(Domain::Guard) unsigned char storage[sizeof(Domain::Guard)];
+};
+
+namespace detail
+{
+
+inline Threads::Registration::Registration()
+{
+    Threads &t = Threads::get();
+    for (int i = 0; i < MAX_THREADS; ++i)
+    {
+        bool expected = false;
+        if (t.inUse[i].compare_exchange_strong(expected, true))
+        {
+            slot = i;
+            return;
+        }
+    }
+    abort();
+}
+
+inline Threads::Registration::~Registration()
+{
+    Threads &t = Threads::get();
+    {
+        std::lock_guard<std::mutex> lk(t.threadsMutex);
+        for (Domain *d : t.domains)
+            d->orphan(slot);
+    }
+    t.inUse[slot].store(false);
+}
+
+} // namespace detail
+
+} // namespace reclaim
+
+#endif // EPOCH_RECLAIM_H
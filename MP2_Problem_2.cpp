@@ -9,6 +9,36 @@
 #include <atomic>
 #include <set>
 #include <chrono>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <climits>
+#include <ctime>
+#include <queue>
+#include <list>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <csignal>
+#include "DeterministicSim.h"
+#include "Tracing.h"
+#include "Metrics.h"
+#include "EpochReclaim.h"
 using namespace std;
 
 // =============================================
@@ -19,6 +49,11 @@ struct Appointment {
     int patientId;
     string datetime;
     string reason;
+    int clinicianId;
+    int day;       // days since 1970-01-01
+    int slot;      // first 15-minute slot of the day
+    int slots;     // length in slots
+    int version;   // bumped on every change; stale reminders are skipped
 };
 
 struct Patient {
@@ -42,196 +77,2908 @@ public:
     atomic<bool> recordLock{false};
 
     // Show current lock status for each resource
-    void displayLockStatus() {
-        cout << "\n--- Lock Status ---\n";
-        cout << "Patient Lock: " << (patientLock ? "LOCKED" : "UNLOCKED") << "\n";
-        cout << "Appointment Lock: " << (appointmentLock ? "LOCKED" : "UNLOCKED") << "\n";
-        cout << "Record Lock: " << (recordLock ? "LOCKED" : "UNLOCKED") << "\n";
+    void displayLockStatus(ostream& out = cout) {
+        out << "\n--- Lock Status ---\n";
+        out << "Patient Lock: " << (patientLock ? "LOCKED" : "UNLOCKED") << "\n";
+        out << "Appointment Lock: " << (appointmentLock ? "LOCKED" : "UNLOCKED") << "\n";
+        out << "Record Lock: " << (recordLock ? "LOCKED" : "UNLOCKED") << "\n";
+        out << "\n--- Lock Waits ---\n";
+        metrics::writeLockTable(out);
+        out << "\n--- Operations ---\n";
+        metrics::writeOperationTable(out);
     }
 
     // Naive check to simulate potential deadlock situations
-    void checkDeadlocks() {
-        cout << "\n--- Deadlock Check ---\n";
+    void checkDeadlocks(ostream& out = cout) {
+        out << "\n--- Deadlock Check ---\n";
         if (patientLock && appointmentLock && recordLock) {
-            cout << "⚠️  Potential deadlock: all resources are locked!\n";
+            out << "⚠️  Potential deadlock: all resources are locked!\n";
         } else {
-            cout << "No deadlocks detected.\n";
+            out << "No deadlocks detected.\n";
         }
     }
 };
 
 LockMonitor lockMonitor; // global lockMonitor
 
+// CHANGE STREAM
+// Every mutation of the three managers, in one order. A manager claims the
+// sequence number while it still holds its own lock, so events about the
+// same data are numbered in the order the changes happened.
+//
+// Events live in a fixed broadcast ring. Each slot is a seqlock: the
+// writer stamps it odd, stores the event as relaxed atomic words and
+// stamps it even; readers copy the words and retry if the stamp moved.
+// Neither side ever takes a lock. Payloads longer than MAX_INLINE are
+// kept whole in a heap string the slot points to; the writer that reuses
+// the slot retires the old string to an epoch domain, so a reader copying
+// it is never left with freed memory. A subscriber that falls a full ring
+// behind loses the overwritten events and is told how many.
+enum class ChangeEntity { Patient, Appointment, Record };
+enum class ChangeOp { Created, Updated, Deleted };
+
+// Payloads are tab-separated fields; free text goes through field() so
+// tabs and newlines inside it survive fields():
+//   Patient      name, age
+//   Appointment  patientId, clinicianId, day, slot, slots, version, reason
+//   Record       Created: name, age; Updated: the appended entry
+struct ChangeEvent {
+    uint64_t seq;
+    ChangeEntity entity;
+    ChangeOp op;
+    int key;
+    string data;
+};
+
+class ChangeStream {
+public:
+    static constexpr size_t CAPACITY = 4096;
+    static constexpr size_t MAX_INLINE = 480;   // longer payloads live on the heap
+
+    struct Subscriber {
+        string name;
+        atomic<uint64_t> next{1};   // next sequence number to read
+        atomic<uint64_t> received{0};
+        atomic<uint64_t> dropped{0};
+        atomic<uint64_t> maxLag{0};
+    };
+
+    ChangeStream() : slots(CAPACITY) {}
+
+    ~ChangeStream() {
+        for (auto& s : slots) delete s.spill.load();
+    }
+
+    void publish(ChangeEntity entity, ChangeOp op, int key, const string& data) {
+        const string* spill = data.size() > MAX_INLINE ? new string(data) : nullptr;
+        uint64_t seq = head.fetch_add(1) + 1;
+        Slot& s = slots[seq % CAPACITY];
+        // a writer a whole lap behind must finish with this slot first
+        uint64_t prior = seq > CAPACITY ? 2 * (seq - CAPACITY) : 0;
+        while (s.stamp.load(memory_order_acquire) != prior) this_thread::yield();
+
+        s.stamp.store(2 * seq - 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        size_t len = data.size();
+        s.words[0].store(uint64_t(entity) | uint64_t(op) << 8 | uint64_t(len) << 16, memory_order_relaxed);
+        s.words[1].store(uint64_t(uint32_t(key)), memory_order_relaxed);
+        const string* old = s.spill.load(memory_order_relaxed);
+        s.spill.store(spill, memory_order_release);
+        for (size_t w = 0; !spill && w * 8 < len; ++w) {
+            uint64_t word = 0;
+            memcpy(&word, data.data() + w * 8, min<size_t>(8, len - w * 8));
+            s.words[2 + w].store(word, memory_order_relaxed);
+        }
+        s.stamp.store(2 * seq, memory_order_release);
+        if (old) spills.retire(old);
+    }
+
+    shared_ptr<Subscriber> subscribe(const string& name, bool fromStart = false) {
+        auto sub = make_shared<Subscriber>();
+        sub->name = name;
+        uint64_t published = head.load();
+        sub->next = fromStart ? oldest(published) : published + 1;
+        lock_guard<mutex> lock(subscribersMutex);
+        subscribers.push_back(sub);
+        return sub;
+    }
+
+    void unsubscribe(const shared_ptr<Subscriber>& sub) {
+        lock_guard<mutex> lock(subscribersMutex);
+        subscribers.erase(remove(subscribers.begin(), subscribers.end(), sub), subscribers.end());
+    }
+
+    // Up to `max` events in order; stops early at one still being written
+    size_t poll(Subscriber& sub, vector<ChangeEvent>& out, size_t max = SIZE_MAX) {
+        size_t n = 0;
+        uint64_t next = sub.next.load();
+        while (n < max) {
+            uint64_t published = head.load();
+            if (next > published) break;
+            sub.maxLag = std::max(sub.maxLag.load(), published - next + 1);
+
+            ChangeEvent e;
+            int r = read(next, e);
+            if (r < 0) {   // overwritten: skip to the oldest event still held
+                uint64_t resume = oldest(published);
+                sub.dropped.fetch_add(resume - next);
+                next = resume;
+                continue;
+            }
+            if (r == 0) break;
+            out.push_back(move(e));
+            ++next;
+            ++n;
+        }
+        sub.next = next;
+        sub.received.fetch_add(n);
+        return n;
+    }
+
+    uint64_t published() const { return head.load(); }
+
+    void report() {
+        uint64_t published = head.load();
+        cout << "\n--- Change Stream ---\n";
+        cout << "Events published: " << published << " (ring holds " << CAPACITY << ")\n";
+        lock_guard<mutex> lock(subscribersMutex);
+        if (subscribers.empty()) cout << "No subscribers.\n";
+        for (const auto& sub : subscribers) {
+            uint64_t next = sub->next.load();
+            cout << sub->name << ": received " << sub->received.load()
+                 << ", lag " << (published >= next ? published - next + 1 : 0)
+                 << ", max lag " << sub->maxLag.load()
+                 << ", dropped " << sub->dropped.load() << "\n";
+        }
+    }
+
+    // Backslash, tab, newline and carriage return as two-character escapes
+    static string escape(const string& text) {
+        string out;
+        out.reserve(text.size());
+        for (char c : text) {
+            switch (c) {
+                case '\\': out += "\\\\"; break;
+                case '\t': out += "\\t"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                default: out += c;
+            }
+        }
+        return out;
+    }
+
+    static string unescape(const string& text) {
+        string out;
+        out.reserve(text.size());
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] != '\\' || i + 1 == text.size()) {
+                out += text[i];
+                continue;
+            }
+            char c = text[++i];
+            out += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+        }
+        return out;
+    }
+
+    // One free-text payload field
+    static string field(const string& text) { return escape(text); }
+
+    static vector<string> fields(const string& data) {
+        vector<string> out;
+        stringstream in(data);
+        string field;
+        while (getline(in, field, '\t')) out.push_back(unescape(field));
+        return out;
+    }
+
+    static string describe(const ChangeEvent& e) {
+        static const char* entities[] = {"patient", "appointment", "record"};
+        static const char* ops[] = {"created", "updated", "deleted"};
+        string fields = e.data;
+        replace(fields.begin(), fields.end(), '\t', '|');
+        return "#" + to_string(e.seq) + " " + entities[int(e.entity)] + " " + to_string(e.key) + " " +
+               ops[int(e.op)] + (fields.empty() ? "" : ": " + fields);
+    }
+
+private:
+    static constexpr size_t WORDS = 2 + MAX_INLINE / 8;
+
+    struct alignas(64) Slot {
+        atomic<uint64_t> stamp{0};   // 2*seq - 1 while writing, 2*seq once done
+        atomic<uint64_t> words[WORDS];
+        atomic<const string*> spill{nullptr};   // the payload when it is longer than MAX_INLINE
+    };
+
+    static uint64_t oldest(uint64_t published) {
+        return published > CAPACITY ? published - CAPACITY + 1 : 1;
+    }
+
+    // 1 = read, 0 = not written yet, -1 = already overwritten
+    int read(uint64_t seq, ChangeEvent& e) const {
+        const Slot& s = slots[seq % CAPACITY];
+        for (;;) {
+            uint64_t before = s.stamp.load(memory_order_acquire);
+            if (before > 2 * seq) return -1;
+            if (before != 2 * seq) return 0;
+
+            uint64_t w0 = s.words[0].load(memory_order_relaxed);
+            uint64_t w1 = s.words[1].load(memory_order_relaxed);
+            size_t len = w0 >> 16;
+            char buf[MAX_INLINE];
+            string spilled;
+            if (len > MAX_INLINE) {
+                // the string stays alive while we copy, even if the slot is reused meanwhile
+                reclaim::Domain::Guard guard(spills);
+                const string* p = s.spill.load(memory_order_acquire);
+                if (p) spilled = *p;
+            } else {
+                for (size_t w = 0; w * 8 < len; ++w) {
+                    uint64_t word = s.words[2 + w].load(memory_order_relaxed);
+                    memcpy(buf + w * 8, &word, min<size_t>(8, len - w * 8));
+                }
+            }
+            atomic_thread_fence(memory_order_acquire);
+            if (s.stamp.load(memory_order_relaxed) != before) continue;
+
+            e.seq = seq;
+            e.entity = ChangeEntity(w0 & 0xff);
+            e.op = ChangeOp((w0 >> 8) & 0xff);
+            e.key = int(uint32_t(w1));
+            if (len > MAX_INLINE) e.data = move(spilled);
+            else e.data.assign(buf, len);
+            return 1;
+        }
+    }
+
+    vector<Slot> slots;
+    mutable reclaim::Domain spills;
+    atomic<uint64_t> head{0};   // last claimed sequence number
+    mutex subscribersMutex;
+    vector<shared_ptr<Subscriber>> subscribers;
+};
+
+ChangeStream changeStream; // global change feed of all three managers
+
+// PATIENT STORES
+// PatientManager keeps its patients in one of two stores with the same
+// interface, picked at compile time so they can be benchmarked against
+// each other: the map behind one shared_mutex (default), or the segmented
+// hash table below (build with -DPATIENT_STORE_CONCURRENT). Both run the
+// `committed` callback while the changed entry is still locked, which is
+// where the manager publishes its change event.
+enum class StoreResult { Done, NotFound, Busy };
+
+// One ordered map behind one reader/writer lock
+class LockedPatientStore {
+public:
+    template <class F>
+    void insert(const Patient& p, F committed) {
+        unique_lock lock(patientMutex);
+        patients[p.id] = p;
+        committed();
+    }
+
+    // Busy instead of waiting when the lock is taken
+    template <class F>
+    StoreResult tryUpdate(const Patient& p, F committed) {
+        unique_lock lock(patientMutex, try_to_lock);
+        if (!lock.owns_lock()) return StoreResult::Busy;
+        auto it = patients.find(p.id);
+        if (it == patients.end()) return StoreResult::NotFound;
+        it->second = p;
+        committed();
+        return StoreResult::Done;
+    }
+
+    template <class F>
+    bool erase(int id, F committed) {
+        unique_lock lock(patientMutex);
+        if (!patients.erase(id)) return false;
+        committed();
+        return true;
+    }
+
+    bool find(int id, Patient& out) {
+        shared_lock lock(patientMutex);
+        auto it = patients.find(id);
+        if (it == patients.end()) return false;
+        out = it->second;
+        return true;
+    }
+
+    // Every patient in id order; mark() runs where the copy is consistent
+    // and its result is returned
+    template <class F>
+    uint64_t copy(vector<Patient>& rows, F mark) {
+        shared_lock lock(patientMutex);
+        rows.reserve(rows.size() + patients.size());
+        for (const auto& entry : patients) rows.push_back(entry.second);
+        return mark();
+    }
+
+    void replace(const vector<Patient>& rows) {
+        map<int, Patient> loaded;
+        for (const auto& p : rows) loaded[p.id] = p;
+        unique_lock lock(patientMutex);
+        patients.swap(loaded);
+    }
+
+    size_t size() {
+        shared_lock lock(patientMutex);
+        return patients.size();
+    }
+
+private:
+    map<int, Patient> patients;
+    TRACE_LOCKABLE_ARGS(metrics::Metered<sim::SharedMutex>, patientMutex, "patientMutex");
+};
+
+// Open-addressing hash table split into segments by key hash. Every slot
+// points to an immutable entry that writers swap whole, so lookups take no
+// lock at all: a reader follows at most one probe run of acquire loads.
+// Writers lock only the segment of their key. Erased slots become
+// tombstones, and a segment is rebuilt into a fresh slot array when live
+// entries plus tombstones pass 70%; entries never move within an array,
+// so a reader racing a writer sees the old entry or the new one.
+//
+// Replaced entries and outgrown arrays are retired to the store's epoch
+// domain; every read is one short epoch section, so a stalled writer or a
+// slow lister never keeps them alive for long.
+class ConcurrentPatientStore {
+public:
+    static constexpr size_t SEGMENTS = 64;
+    static constexpr size_t INITIAL_SLOTS = 16;
+
+    ConcurrentPatientStore() {
+        for (auto& s : segments) s.slots.store(new Slots(INITIAL_SLOTS));
+    }
+
+    ~ConcurrentPatientStore() {
+        for (auto& s : segments) {
+            Slots* slots = s.slots.load();
+            for (size_t i = 0; i <= slots->mask; ++i) {
+                const Entry* e = slots->at[i].load();
+                if (e && e != tombstone()) delete e;
+            }
+            delete slots;
+        }
+    }
+
+    ConcurrentPatientStore(const ConcurrentPatientStore&) = delete;
+    ConcurrentPatientStore& operator=(const ConcurrentPatientStore&) = delete;
+
+    template <class F>
+    void insert(const Patient& p, F committed) {
+        Segment& s = segmentOf(p.id);
+        unique_lock lock(s.segmentMutex);
+        put(s, p);
+        committed();
+    }
+
+    // Busy instead of waiting when the key's segment is locked
+    template <class F>
+    StoreResult tryUpdate(const Patient& p, F committed) {
+        Segment& s = segmentOf(p.id);
+        unique_lock lock(s.segmentMutex, try_to_lock);
+        if (!lock.owns_lock()) return StoreResult::Busy;
+        if (probe(*s.slots.load(memory_order_relaxed), p.id) == NONE) return StoreResult::NotFound;
+        put(s, p);
+        committed();
+        return StoreResult::Done;
+    }
+
+    template <class F>
+    bool erase(int id, F committed) {
+        Segment& s = segmentOf(id);
+        unique_lock lock(s.segmentMutex);
+        Slots& slots = *s.slots.load(memory_order_relaxed);
+        size_t i = probe(slots, id);
+        if (i == NONE) return false;
+        const Entry* old = slots.at[i].load(memory_order_relaxed);
+        slots.at[i].store(tombstone(), memory_order_release);
+        epochs.retire(old);
+        --s.live;
+        count.fetch_sub(1);
+        committed();
+        return true;
+    }
+
+    // Never blocks
+    bool find(int id, Patient& out) {
+        reclaim::Domain::Guard guard(epochs);
+        Slots& slots = *segmentOf(id).slots.load();
+        size_t i = (hashOf(id) / SEGMENTS) & slots.mask;
+        for (size_t n = 0; n <= slots.mask; ++n, i = (i + 1) & slots.mask) {
+            const Entry* e = slots.at[i].load();
+            if (!e) return false;
+            if (e != tombstone() && e->patient.id == id) {
+                out = e->patient;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Every patient in id order. The mark is taken before the scan: an entry
+    // the scan sees was changed no later than its event, and replaying the
+    // events after the mark brings every later change in.
+    template <class F>
+    uint64_t copy(vector<Patient>& rows, F mark) {
+        uint64_t marked = mark();
+        size_t first = rows.size();
+        rows.reserve(first + size());
+        for (auto& s : segments) {
+            reclaim::Domain::Guard guard(epochs);
+            Slots& slots = *s.slots.load();
+            for (size_t i = 0; i <= slots.mask; ++i) {
+                const Entry* e = slots.at[i].load();
+                if (e && e != tombstone()) rows.push_back(e->patient);
+            }
+        }
+        sort(rows.begin() + first, rows.end(), [](const Patient& a, const Patient& b) { return a.id < b.id; });
+        return marked;
+    }
+
+    // Locks every segment (in order) so readers never see half of it
+    void replace(const vector<Patient>& rows) {
+        vector<unique_lock<decltype(segments[0].segmentMutex)>> locks;
+        for (auto& s : segments) locks.emplace_back(s.segmentMutex);
+        for (auto& s : segments) {
+            Slots* old = s.slots.load(memory_order_relaxed);
+            for (size_t i = 0; i <= old->mask; ++i) {
+                const Entry* e = old->at[i].load(memory_order_relaxed);
+                if (e && e != tombstone()) epochs.retire(e);
+            }
+            s.slots.store(new Slots(INITIAL_SLOTS), memory_order_release);
+            epochs.retire(old);
+            s.used = s.live = 0;
+        }
+        count.store(0);
+        for (const auto& p : rows) put(segmentOf(p.id), p);
+    }
+
+    size_t size() const { return size_t(max<int64_t>(0, count.load())); }
+
+private:
+    struct Entry {
+        Patient patient;
+    };
+
+    struct Slots {
+        explicit Slots(size_t n) : mask(n - 1), at(new atomic<const Entry*>[n]) {
+            for (size_t i = 0; i < n; ++i) at[i].store(nullptr, memory_order_relaxed);
+        }
+        size_t mask;
+        unique_ptr<atomic<const Entry*>[]> at;
+    };
+
+    struct alignas(64) Segment {
+        atomic<Slots*> slots{nullptr};
+        TRACE_LOCKABLE_ARGS(metrics::Metered<sim::Mutex>, segmentMutex, "patientSegment");
+        size_t used = 0;   // live entries plus tombstones; segmentMutex held
+        size_t live = 0;
+    };
+
+    static constexpr size_t NONE = SIZE_MAX;
+
+    static const Entry* tombstone() {
+        static const Entry marker{};
+        return &marker;
+    }
+
+    static uint64_t hashOf(int id) {
+        uint64_t x = uint32_t(id);
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        return x ^ (x >> 33);
+    }
+
+    Segment& segmentOf(int id) { return segments[hashOf(id) % SEGMENTS]; }
+
+    // Slot holding id, or NONE; stops at the first never-used slot (segmentMutex held)
+    static size_t probe(const Slots& slots, int id) {
+        size_t i = (hashOf(id) / SEGMENTS) & slots.mask;
+        for (size_t n = 0; n <= slots.mask; ++n, i = (i + 1) & slots.mask) {
+            const Entry* e = slots.at[i].load(memory_order_relaxed);
+            if (!e) return NONE;
+            if (e != tombstone() && e->patient.id == id) return i;
+        }
+        return NONE;
+    }
+
+    // Insert or replace (segmentMutex held)
+    void put(Segment& s, const Patient& p) {
+        Slots& slots = *s.slots.load(memory_order_relaxed);
+        size_t i = (hashOf(p.id) / SEGMENTS) & slots.mask, reuse = NONE;
+        for (size_t n = 0; n <= slots.mask; ++n, i = (i + 1) & slots.mask) {
+            const Entry* e = slots.at[i].load(memory_order_relaxed);
+            if (!e) {
+                if (reuse == NONE) {
+                    reuse = i;
+                    ++s.used;
+                }
+                break;
+            }
+            if (e == tombstone()) {
+                if (reuse == NONE) reuse = i;
+                continue;
+            }
+            if (e->patient.id == p.id) {
+                slots.at[i].store(new Entry{p}, memory_order_release);
+                epochs.retire(e);
+                return;
+            }
+        }
+        slots.at[reuse].store(new Entry{p}, memory_order_release);
+        ++s.live;
+        count.fetch_add(1);
+        if (s.used * 10 > (slots.mask + 1) * 7) rebuild(s);
+    }
+
+    // Copy the live entries into a fresh array, doubled if they alone fill
+    // more than 35% (segmentMutex held)
+    void rebuild(Segment& s) {
+        Slots* old = s.slots.load(memory_order_relaxed);
+        size_t n = old->mask + 1;
+        if (s.live * 20 > n * 7) n *= 2;
+        Slots* fresh = new Slots(n);
+        for (size_t i = 0; i <= old->mask; ++i) {
+            const Entry* e = old->at[i].load(memory_order_relaxed);
+            if (!e || e == tombstone()) continue;
+            size_t j = (hashOf(e->patient.id) / SEGMENTS) & fresh->mask;
+            while (fresh->at[j].load(memory_order_relaxed)) j = (j + 1) & fresh->mask;
+            fresh->at[j].store(e, memory_order_relaxed);
+        }
+        s.slots.store(fresh, memory_order_release);
+        epochs.retire(old);
+        s.used = s.live;
+    }
+
+    Segment segments[SEGMENTS];
+    atomic<int64_t> count{0};
+    reclaim::Domain epochs;
+};
+
+#ifdef PATIENT_STORE_CONCURRENT
+using PatientStore = ConcurrentPatientStore;
+#else
+using PatientStore = LockedPatientStore;
+#endif
+
 // PATIENT MANAGER
 class PatientManager {
 private:
-    map<int, Patient> patients;
-    shared_mutex patientMutex;
-    int nextPatientId = 0;
+    PatientStore patients;
+    atomic<int> nextPatientId{0};
+    metrics::Gauge& patientCount = metrics::gauge("patients", "Registered patients");
+    metrics::Operation registerOp{"registerPatient"}, updateOp{"updatePatient"}, removeOp{"removePatient"},
+        viewOp{"viewPatient"};
 
 public:
     // Register a new patient
-    void registerPatient(const string& name, int age) {
+    void registerPatient(const string& name, int age, ostream& out = cout) {
+        TRACE_SPAN("registerPatient");
+        metrics::Operation::Scope metered(registerOp);
         lockMonitor.patientLock = true;
-        unique_lock lock(patientMutex);
         int id = ++nextPatientId;
-        patients[id] = {id, name, age};
-        cout << "Patient registered with ID " << id << ": " << name << "\n";
+        patients.insert({id, name, age}, [&]() {
+            changeStream.publish(ChangeEntity::Patient, ChangeOp::Created, id,
+                                 ChangeStream::field(name) + "\t" + to_string(age));
+        });
+        patientCount.set(patients.size());
+        out << "Patient registered with ID " << id << ": " << name << "\n";
         lockMonitor.patientLock = false;
     }
 
     // Update EXISTING patient
-    void updatePatient(int id, const string& name, int age) {
-        if (patientMutex.try_lock()) {
-            if (patients.find(id) != patients.end()) {
-                patients[id] = {id, name, age};
-                cout << "Patient updated: " << name << "\n";
-            } else {
-                cout << "Patient not found.\n";
-            }
-            patientMutex.unlock();
+    void updatePatient(int id, const string& name, int age, ostream& out = cout) {
+        TRACE_SPAN("updatePatient");
+        metrics::Operation::Scope metered(updateOp);
+        StoreResult r = patients.tryUpdate({id, name, age}, [&]() {
+            changeStream.publish(ChangeEntity::Patient, ChangeOp::Updated, id,
+                                 ChangeStream::field(name) + "\t" + to_string(age));
+        });
+        if (r == StoreResult::Done) {
+            out << "Patient updated: " << name << "\n";
+        } else if (r == StoreResult::NotFound) {
+            out << "Patient not found.\n";
+            metered.error();
         } else {
-            cout << "Patient database is busy. Try again later.\n";
+            out << "Patient database is busy. Try again later.\n";
+            metered.busy();
         }
     }
 
     // Remove an EXISTING/registered patient(s)
-    void removePatient(int id) {
+    void removePatient(int id, ostream& out = cout) {
+        TRACE_SPAN("removePatient");
+        metrics::Operation::Scope metered(removeOp);
         lockMonitor.patientLock = true;
-        unique_lock lock(patientMutex);
-        if (patients.erase(id)) {
-            cout << "Patient removed.\n";
+        if (patients.erase(id, [&]() { changeStream.publish(ChangeEntity::Patient, ChangeOp::Deleted, id, ""); })) {
+            patientCount.set(patients.size());
+            out << "Patient removed.\n";
+        } else {
+            out << "Patient not found.\n";
+            metered.error();
+        }
+        lockMonitor.patientLock = false;
+    }
+
+    // Look up one patient
+    void viewPatient(int id, ostream& out = cout) {
+        TRACE_SPAN("viewPatient");
+        metrics::Operation::Scope metered(viewOp);
+        Patient p;
+        if (patients.find(id, p)) {
+            out << "ID: " << p.id << ", Name: " << p.name << ", Age: " << p.age << "\n";
         } else {
-            cout << "Patient not found.\n";
+            out << "Patient not found.\n";
+            metered.error();
+        }
+    }
+
+    // Copy of every patient; the result is the last sequence number it reflects
+    uint64_t copyRows(vector<Patient>& rows) {
+        return patients.copy(rows, []() { return changeStream.published(); });
+    }
+
+    // Current patients as Created events; the result is the last sequence
+    // number they reflect
+    uint64_t snapshot(vector<ChangeEvent>& rows) {
+        vector<Patient> all;
+        uint64_t mark = copyRows(all);
+        for (const auto& patient : all) {
+            rows.push_back({0, ChangeEntity::Patient, ChangeOp::Created, patient.id,
+                            ChangeStream::field(patient.name) + "\t" + to_string(patient.age)});
         }
+        return mark;
+    }
+
+    // Replace every patient with a leader's snapshot (follower side)
+    void loadSnapshot(const vector<ChangeEvent>& rows) {
+        vector<Patient> loaded;
+        for (const auto& e : rows) {
+            vector<string> f = ChangeStream::fields(e.data);
+            if (f.size() >= 2) loaded.push_back({e.key, f[0], atoi(f[1].c_str())});
+        }
+        patients.replace(loaded);
+        patientCount.set(patients.size());
+    }
+
+    // Apply one leader change (follower side)
+    void applyChange(const ChangeEvent& e) {
+        lockMonitor.patientLock = true;
+        vector<string> f = ChangeStream::fields(e.data);
+        if (e.op == ChangeOp::Deleted) patients.erase(e.key, []() {});
+        else if (f.size() >= 2) patients.insert({e.key, f[0], atoi(f[1].c_str())}, []() {});
+        patientCount.set(patients.size());
         lockMonitor.patientLock = false;
     }
 
     // List all EXISTING/registered patient(s)
-    void listPatient() {
+    void listPatient(ostream& out = cout) {
+        TRACE_SPAN("listPatient");
         lockMonitor.patientLock = true;
-        shared_lock lock(patientMutex);
-        for (const auto& [id, patient] : patients) {
-            cout << "ID: " << id << ", Name: " << patient.name << ", Age: " << patient.age << "\n";
+        vector<Patient> all;
+        patients.copy(all, []() { return uint64_t(0); });
+        for (const auto& patient : all) {
+            out << "ID: " << patient.id << ", Name: " << patient.name << ", Age: " << patient.age << "\n";
         }
         lockMonitor.patientLock = false;
     }
 };
 
-// APPOINTMENT MANAGER
-class AppointmentManager {
+// WORKER POOL
+// Fixed threads that help run parallelFor jobs; the caller always works on
+// its own job too, so a busy pool only costs parallelism, never progress.
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threads) {
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            lock_guard<mutex> lock(poolMutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (auto& w : workers) w.join();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    // Run body(i) for every i in [0, count); returns once all calls finished
+    void parallelFor(int count, const function<void(int)>& body) {
+        auto job = make_shared<Job>();
+        job->body = &body;
+        job->count = count;
+        {
+            lock_guard<mutex> lock(poolMutex);
+            jobs.push_back(job);
+        }
+        jobReady.notify_all();
+
+        runItems(*job);
+
+        unique_lock<mutex> lock(poolMutex);
+        jobs.erase(remove(jobs.begin(), jobs.end(), job), jobs.end());
+        jobDone.wait(lock, [&]() { return job->finished.load() == job->count; });
+    }
+
+    // Run task on a pool thread and return at once; needs at least one worker
+    void submit(function<void()> task) {
+        auto job = make_shared<Job>();
+        job->owned = [task = move(task)](int) { task(); };
+        job->body = &job->owned;
+        job->count = 1;
+        {
+            lock_guard<mutex> lock(poolMutex);
+            jobs.push_back(job);
+        }
+        jobReady.notify_one();
+    }
+
 private:
-    map<int, Appointment> appointments;
-    mutex appMutex;
-    condition_variable_any appointmentNotif;
-    int nextAppointmentId = 0;
+    struct Job {
+        const function<void(int)>* body = nullptr;
+        function<void(int)> owned;   // body of a submitted job
+        int count = 0;
+        atomic<int> next{0};
+        atomic<int> finished{0};
+    };
+
+    // Claim items until none are left; the last finisher wakes the caller
+    void runItems(Job& job) {
+        int done = 0;
+        for (int i = job.next.fetch_add(1); i < job.count; i = job.next.fetch_add(1)) {
+            (*job.body)(i);
+            ++done;
+        }
+        if (done > 0 && job.finished.fetch_add(done) + done == job.count) {
+            lock_guard<mutex> lock(poolMutex);
+            jobDone.notify_all();
+        }
+    }
+
+    void work() {
+        TRACE_THREAD_NAME("pool worker");
+        unique_lock<mutex> lock(poolMutex);
+        while (true) {
+            jobReady.wait(lock, [&]() { return stopping || !jobs.empty(); });
+            if (stopping) return;
+            shared_ptr<Job> job = jobs.front();
+            if (job->next.load() >= job->count) {
+                // fully claimed; let its caller remove it
+                jobs.pop_front();
+                continue;
+            }
+            lock.unlock();
+            runItems(*job);
+            lock.lock();
+        }
+    }
 
+    vector<thread> workers;
+    deque<shared_ptr<Job>> jobs;
+    mutex poolMutex;
+    condition_variable jobReady;
+    condition_variable jobDone;
+    bool stopping = false;
+};
+
+// SLOT CALENDAR
+// Each clinician's day is a 96-bit bitmap of 15-minute slots (bits 96..127
+// are kept set so runs never cross midnight). Conflict checks and the
+// earliest-free-run search are a handful of word operations per day.
+// Every clinician has its own lock, so searches only ever hold one
+// clinician at a time and never stall bookings for the others.
+class SlotCalendar {
 public:
-    // Schedule appointments
-    void scheduleAppointment(int patientId, const string& datetime, const string& reason) {
-        lockMonitor.appointmentLock = true;
-        unique_lock lock(appMutex);
-        int id = ++nextAppointmentId;
-        appointments[id] = {id, patientId, datetime, reason};
-        cout << "Appointment scheduled with ID " << id << ".\n";
-        appointmentNotif.notify_all();  // Notifies the system if there are waiting threads
-        lockMonitor.appointmentLock = false;
+    // Earliest `slots`-long run inside [from, to) and within daily hours
+    struct Query {
+        vector<int> clinicians;   // empty = every clinician with bookings
+        int fromDay, fromSlot;
+        int toDay, toSlot;
+        int dayStart = 0, dayEnd = 24 * 60 / 15;
+        int slots;
+    };
+
+    struct Match {
+        bool found = false;
+        int clinicianId = 0, day = 0, slot = 0;
+    };
+
+    static constexpr int SLOT_MINUTES = 15;
+    static constexpr int SLOTS_PER_DAY = 24 * 60 / SLOT_MINUTES;
+    static constexpr int MAX_SEARCH_DAYS = 366;
+
+    // "YYYY-MM-DD HH:MM" on a 15-minute boundary
+    static bool parse(const string& datetime, int& day, int& slot) {
+        int y, mo, d, h, mi;
+        char tail;
+        if (sscanf(datetime.c_str(), "%d-%d-%d %d:%d%c", &y, &mo, &d, &h, &mi, &tail) != 5) return false;
+        if (mo < 1 || mo > 12 || d < 1 || d > daysInMonth(y, mo)) return false;
+        if (h < 0 || h > 23 || mi < 0 || mi > 59 || mi % SLOT_MINUTES != 0) return false;
+        day = daysFromCivil(y, mo, d);
+        slot = (h * 60 + mi) / SLOT_MINUTES;
+        return true;
     }
 
-    // Update EXISTING appointment
-    // Emphasis on existing
-    void updateAppointment(int id, const string& newDatetime, const string& newReason) {
-        if (appMutex.try_lock()) {
-            if (appointments.find(id) != appointments.end()) {
-                appointments[id].datetime = newDatetime;
-                appointments[id].reason = newReason;
-                cout << "Appointment updated.\n";
+    // "HH:MM" on a 15-minute boundary; "24:00" is the end of the day
+    static bool parseTime(const string& hhmm, int& slot) {
+        if (hhmm == "24:00") {
+            slot = SLOTS_PER_DAY;
+            return true;
+        }
+        int day;
+        return parse("2000-01-01 " + hhmm, day, slot);
+    }
+
+    // Local wall-clock time of a slot
+    static chrono::system_clock::time_point toTimePoint(int day, int slot) {
+        tm t{};
+        civilFromDays(day, t.tm_year, t.tm_mon, t.tm_mday);
+        t.tm_year -= 1900;
+        t.tm_mon -= 1;
+        t.tm_hour = slot * SLOT_MINUTES / 60;
+        t.tm_min = slot * SLOT_MINUTES % 60;
+        t.tm_isdst = -1;
+        return chrono::system_clock::from_time_t(mktime(&t));
+    }
+
+    static string format(int day, int slot) {
+        int y, mo, d;
+        civilFromDays(day, y, mo, d);
+        char buf[48];
+        snprintf(buf, sizeof buf, "%04d-%02d-%02d %02d:%02d", y, mo, d,
+                 slot * SLOT_MINUTES / 60, slot * SLOT_MINUTES % 60);
+        return buf;
+    }
+
+    static int slotsFor(int minutes) {
+        return (minutes + SLOT_MINUTES - 1) / SLOT_MINUTES;
+    }
+
+    bool isFree(int clinicianId, int day, int slot, int count) const {
+        if (slot < 0 || count < 1 || slot + count > SLOTS_PER_DAY) return false;
+        const Clinician* c = find(clinicianId);
+        if (!c) return true;
+        shared_lock lock(c->lock);
+        return (c->load(day) & runMask(slot, count)) == 0;
+    }
+
+    // The free run [start, end) of a day that contains `slot`; false if the slot is busy
+    bool freeRun(int clinicianId, int day, int slot, int& start, int& end) const {
+        if (slot < 0 || slot >= SLOTS_PER_DAY) return false;
+        const Clinician* c = find(clinicianId);
+        Bits busy = emptyDay();
+        if (c) {
+            shared_lock lock(c->lock);
+            busy = c->load(day);
+        }
+        auto taken = [&](int i) { return (busy & runMask(i, 1)) != 0; };
+        if (taken(slot)) return false;
+        for (start = slot; start > 0 && !taken(start - 1); --start) {
+        }
+        for (end = slot + 1; !taken(end); ++end) {   // bit 96 is always set
+        }
+        return true;
+    }
+
+    // Marks the slots busy; false (and no change) if any of them is taken
+    bool reserve(int clinicianId, int day, int slot, int count) {
+        if (slot < 0 || count < 1 || slot + count > SLOTS_PER_DAY) return false;
+        Clinician& c = findOrAdd(clinicianId);
+        unique_lock lock(c.lock);
+        Bits busy = c.load(day);
+        if ((busy & runMask(slot, count)) != 0) return false;
+        c.store(day, busy | runMask(slot, count));
+        return true;
+    }
+
+    void release(int clinicianId, int day, int slot, int count) {
+        Clinician* c = find(clinicianId);
+        if (!c) return;
+        unique_lock lock(c->lock);
+        c->store(day, c->load(day) & ~runMask(slot, count));
+    }
+
+    // Earliest run of `count` free slots at or after (day, slot)
+    bool findEarliest(int clinicianId, int fromDay, int fromSlot, int count, int& day, int& slot) const {
+        Query q;
+        q.clinicians = {clinicianId};
+        q.fromDay = fromDay;
+        q.fromSlot = fromSlot;
+        q.toDay = fromDay + MAX_SEARCH_DAYS;
+        q.toSlot = 0;
+        q.slots = count;
+        Match m = findEarliest(q, nullptr);
+        day = m.day;
+        slot = m.slot;
+        return m.found;
+    }
+
+    // Earliest match over many clinicians, spread over the pool (or run
+    // inline without one). Ties go to the lower clinician ID. The shared
+    // best answer lets every worker stop at the first day that cannot
+    // beat it.
+    Match findEarliest(const Query& q, WorkerPool* pool) const {
+        Match result;
+        if (q.slots < 1 || q.slots > SLOTS_PER_DAY) return result;
+
+        vector<int> ids = q.clinicians;
+        if (ids.empty()) {
+            shared_lock lock(directoryMutex);
+            for (const auto& entry : clinicians) ids.push_back(entry.first);
+        }
+        if (ids.empty()) return result;
+
+        // (slots since the first day of the window began) << 32 | clinician, smaller is better
+        atomic<uint64_t> best{UINT64_MAX};
+        auto scan = [&](int i) { scanClinician(q, ids[i], best); };
+
+        if (pool && ids.size() > 1) pool->parallelFor(static_cast<int>(ids.size()), scan);
+        else for (size_t i = 0; i < ids.size(); ++i) scan(static_cast<int>(i));
+
+        uint64_t b = best.load();
+        if (b == UINT64_MAX) return result;
+        long long offset = static_cast<long long>(b >> 32) + q.fromDay * 1LL * SLOTS_PER_DAY;
+        result.found = true;
+        result.clinicianId = static_cast<int>(static_cast<uint32_t>(b));
+        result.day = static_cast<int>(offset / SLOTS_PER_DAY);
+        result.slot = static_cast<int>(offset % SLOTS_PER_DAY);
+        return result;
+    }
+
+private:
+#ifdef __SIZEOF_INT128__
+    using Bits = unsigned __int128;
+    static Bits lowBits(int n) { return n >= 128 ? ~Bits(0) : (Bits(1) << n) - 1; }
+    static int lowestSet(Bits b) {
+        uint64_t lo = uint64_t(b);
+        return lo ? __builtin_ctzll(lo) : 64 + __builtin_ctzll(uint64_t(b >> 64));
+    }
+#else
+    // Two-word fallback for compilers without a 128-bit integer
+    struct Bits {
+        uint64_t lo, hi;
+        Bits(uint64_t l = 0, uint64_t h = 0) : lo(l), hi(h) {}
+        Bits operator&(Bits o) const { return {lo & o.lo, hi & o.hi}; }
+        Bits operator|(Bits o) const { return {lo | o.lo, hi | o.hi}; }
+        Bits operator~() const { return {~lo, ~hi}; }
+        Bits operator>>(int n) const {
+            if (n == 0) return *this;
+            if (n >= 64) return {hi >> (n - 64), 0};
+            return {(lo >> n) | (hi << (64 - n)), hi >> n};
+        }
+        Bits operator<<(int n) const {
+            if (n == 0) return *this;
+            if (n >= 64) return {0, lo << (n - 64)};
+            return {lo << n, (hi << n) | (lo >> (64 - n))};
+        }
+        bool operator==(Bits o) const { return lo == o.lo && hi == o.hi; }
+        bool operator!=(Bits o) const { return !(*this == o); }
+        Bits& operator&=(Bits o) { return *this = *this & o; }
+    };
+    static Bits lowBits(int n) {
+        if (n >= 128) return {~0ull, ~0ull};
+        if (n >= 64) return {~0ull, n == 64 ? 0 : (1ull << (n - 64)) - 1};
+        return {(1ull << n) - 1, 0};
+    }
+    static int lowestSet(Bits b) {
+        return b.lo ? __builtin_ctzll(b.lo) : 64 + __builtin_ctzll(b.hi);
+    }
+#endif
+
+    static Bits runMask(int slot, int count) { return lowBits(count) << slot; }
+    static Bits emptyDay() { return ~lowBits(SLOTS_PER_DAY); }
+
+    struct Clinician {
+        mutable shared_mutex lock;
+        unordered_map<int, Bits> days;   // day -> busy slots, empty days dropped
+
+        Bits load(int day) const {
+            auto d = days.find(day);
+            return d == days.end() ? emptyDay() : d->second;
+        }
+        void store(int day, Bits bits) {
+            if (bits == emptyDay()) days.erase(day);
+            else days[day] = bits;
+        }
+    };
+
+    // Scan one clinician day by day, giving up as soon as the day's first
+    // slot already sorts after the best answer found so far
+    void scanClinician(const Query& q, int clinicianId, atomic<uint64_t>& best) const {
+        const Clinician* c = find(clinicianId);
+        shared_lock<shared_mutex> lock;
+        if (c) lock = shared_lock(c->lock);
+
+        int lastDay = min(q.toDay, q.fromDay + MAX_SEARCH_DAYS);
+        uint64_t tag = static_cast<uint32_t>(clinicianId);
+        for (int d = q.fromDay; d <= lastDay; ++d) {
+            uint64_t dayStart = static_cast<uint64_t>(d - q.fromDay) * SLOTS_PER_DAY;
+            if ((dayStart << 32) > best.load(memory_order_relaxed)) return;
+
+            int lo = max(q.dayStart, d == q.fromDay ? q.fromSlot : 0);
+            int hi = min(q.dayEnd, d == q.toDay ? q.toSlot : SLOTS_PER_DAY);
+            if (hi - lo < q.slots) continue;
+
+            // slots outside [lo, hi) count as busy for this query
+            Bits busy = (c ? c->load(d) : emptyDay()) | lowBits(lo) | ~lowBits(hi);
+            int found = firstRun(busy, lo, q.slots);
+            if (found < 0) continue;
+
+            uint64_t key = ((dayStart + found) << 32) | tag;
+            uint64_t cur = best.load();
+            while (key < cur && !best.compare_exchange_weak(cur, key)) {
+            }
+            return;
+        }
+    }
+
+    const Clinician* find(int clinicianId) const {
+        shared_lock lock(directoryMutex);
+        auto it = clinicians.find(clinicianId);
+        return it == clinicians.end() ? nullptr : it->second.get();
+    }
+
+    Clinician* find(int clinicianId) {
+        return const_cast<Clinician*>(static_cast<const SlotCalendar*>(this)->find(clinicianId));
+    }
+
+    // Entries are never removed, so the pointer stays valid unlocked
+    Clinician& findOrAdd(int clinicianId) {
+        if (Clinician* c = find(clinicianId)) return *c;
+        unique_lock lock(directoryMutex);
+        auto& slot = clinicians[clinicianId];
+        if (!slot) slot = make_unique<Clinician>();
+        return *slot;
+    }
+
+    // Bit i of the result survives iff slots i..i+count-1 are all free:
+    // shift-and of the free map with doubling strides, O(log count) steps
+    static int firstRun(Bits busy, int from, int count) {
+        Bits run = ~busy;
+        int covered = 1;
+        while (covered < count) {
+            int step = min(covered, count - covered);
+            run &= run >> step;
+            covered += step;
+        }
+        run &= ~lowBits(from);
+        run &= lowBits(SLOTS_PER_DAY);
+        return run == 0 ? -1 : lowestSet(run);
+    }
+
+    static bool leapYear(int y) { return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0; }
+    static int daysInMonth(int y, int m) {
+        static const int dim[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        return m == 2 && leapYear(y) ? 29 : dim[m - 1];
+    }
+
+    // Proleptic Gregorian day numbers (H. Hinnant's algorithms)
+    static int daysFromCivil(int y, int m, int d) {
+        y -= m <= 2;
+        int era = (y >= 0 ? y : y - 399) / 400;
+        int yoe = y - era * 400;
+        int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+    static void civilFromDays(int z, int& y, int& m, int& d) {
+        z += 719468;
+        int era = (z >= 0 ? z : z - 146096) / 146097;
+        int doe = z - era * 146097;
+        int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        int mp = (5 * doy + 2) / 153;
+        d = doy - (153 * mp + 2) / 5 + 1;
+        m = mp + (mp < 10 ? 3 : -9);
+        y = yoe + era * 400 + (m <= 2);
+    }
+
+    mutable shared_mutex directoryMutex;
+    map<int, unique_ptr<Clinician>> clinicians;
+};
+
+// Shared by every cross-clinician search
+WorkerPool& searchPool() {
+    static WorkerPool pool(max(1u, thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+// APPOINTMENT MANAGER
+class AppointmentManager {
+private:
+    map<int, Appointment> appointments;
+    SlotCalendar calendar;   // locks per clinician; bookings also hold appMutex
+    TRACE_LOCKABLE_ARGS(metrics::Metered<sim::Mutex>, appMutex, "appMutex");
+    sim::CondVar appointmentNotif;
+    int nextAppointmentId = 0;
+    metrics::Gauge& appointmentCount = metrics::gauge("appointments", "Scheduled appointments");
+    metrics::Gauge& waitlistDepth = metrics::gauge("waitlist_entries", "Requests waiting for a freed slot");
+    metrics::Gauge& dispatcherDepth = metrics::gauge("dispatcher_queue_depth", "Pending reminders and freed slots");
+    metrics::Operation scheduleOp{"scheduleAppointment"}, updateOp{"updateAppointment"},
+        cancelOp{"cancelAppointment"}, waitlistOp{"joinWaitlist"};
+
+    // Reminder service; everything below is guarded by appMutex
+    struct Reminder {
+        chrono::system_clock::time_point at;
+        int appointmentId;
+        int version;
+        int offsetMinutes;
+        bool operator>(const Reminder& o) const { return at > o.at; }
+    };
+    static constexpr size_t OUTBOX_SIZE = 100;
+    priority_queue<Reminder, vector<Reminder>, greater<>> reminders;
+    vector<int> reminderOffsets{24 * 60, 60};   // minutes before the appointment
+    deque<string> outbox;
+    bool stopReminders = false;
+    thread reminderThread;
+
+    // Waitlist per (clinician, day), bucketed by length in slots with each
+    // bucket in arrival order. At most 96 buckets, so matching a freed gap is
+    // a map lookup plus a bounded scan of bucket fronts.
+    struct WaitlistEntry {
+        int id;
+        int patientId;
+        int slots;
+        string reason;
+    };
+    struct FreedSlots {
+        int clinicianId, day, slot, slots;
+    };
+    map<pair<int, int>, map<int, deque<WaitlistEntry>>> waitlists;
+    deque<FreedSlots> freed;   // filled by cancel/update, drained by the dispatcher
+    int nextWaitlistId = 0;
+
+    // appMutex held
+    void noteQueueDepth() {
+        dispatcherDepth.set(int64_t(reminders.size() + freed.size()));
+    }
+
+    // O(log n) per offset; the old entries of a changed appointment stay in
+    // the heap and are dropped when they surface (appMutex held)
+    void queueReminders(const Appointment& appt) {
+        auto start = SlotCalendar::toTimePoint(appt.day, appt.slot);
+        if (start <= chrono::system_clock::now()) return;
+        for (int offset : reminderOffsets) {
+            reminders.push({start - chrono::minutes(offset), appt.id, appt.version, offset});
+        }
+        noteQueueDepth();
+        appointmentNotif.notify_all();
+    }
+
+    // Sleeps until the earliest reminder is due or appointmentNotif reports
+    // a new or changed appointment
+    void dispatchReminders() {
+        TRACE_THREAD_NAME("appointment dispatcher");
+        unique_lock lock(appMutex);
+        while (!stopReminders) {
+            if (!freed.empty()) {
+                FreedSlots f = freed.front();
+                freed.pop_front();
+                noteQueueDepth();
+                backfill(f);
+                continue;
+            }
+            if (reminders.empty()) {
+                appointmentNotif.wait(lock);
+                continue;
+            }
+            Reminder next = reminders.top();
+            if (chrono::system_clock::now() < next.at) {
+                appointmentNotif.wait_until(lock, next.at);
+                continue;
+            }
+            reminders.pop();
+            noteQueueDepth();
+
+            auto it = appointments.find(next.appointmentId);
+            if (it == appointments.end() || it->second.version != next.version) continue;   // cancelled or moved
+
+            const Appointment& appt = it->second;
+            outbox.push_back("Reminder (" + to_string(next.offsetMinutes) + " min before): appointment " +
+                             to_string(appt.id) + " for patient " + to_string(appt.patientId) +
+                             " with clinician " + to_string(appt.clinicianId) + " at " + appt.datetime);
+            if (outbox.size() > OUTBOX_SIZE) outbox.pop_front();
+        }
+    }
+
+    // Change event for an appointment; the sequence number is set on publish
+    static ChangeEvent changeEvent(ChangeOp op, const Appointment& a) {
+        string data;
+        if (op != ChangeOp::Deleted) {
+            data = to_string(a.patientId) + "\t" + to_string(a.clinicianId) + "\t" + to_string(a.day) + "\t" +
+                   to_string(a.slot) + "\t" + to_string(a.slots) + "\t" + to_string(a.version) + "\t" +
+                   ChangeStream::field(a.reason);
+        }
+        return {0, ChangeEntity::Appointment, op, a.id, data};
+    }
+
+    // appMutex held
+    static void publishChange(ChangeOp op, const Appointment& a) {
+        ChangeEvent e = changeEvent(op, a);
+        changeStream.publish(e.entity, e.op, e.key, e.data);
+    }
+
+    // Mirror a leader change, keeping the calendar in step (appMutex held)
+    void applyLocked(const ChangeEvent& e) {
+        auto it = appointments.find(e.key);
+        if (it != appointments.end()) {
+            calendar.release(it->second.clinicianId, it->second.day, it->second.slot, it->second.slots);
+            if (e.op == ChangeOp::Deleted) appointments.erase(it);
+        }
+        if (e.op == ChangeOp::Deleted) return;
+
+        vector<string> f = ChangeStream::fields(e.data);
+        if (f.size() < 6) return;
+        Appointment a{e.key, atoi(f[0].c_str()), "", f.size() > 6 ? f[6] : "", atoi(f[1].c_str()),
+                      atoi(f[2].c_str()), atoi(f[3].c_str()), atoi(f[4].c_str()), atoi(f[5].c_str())};
+        a.datetime = SlotCalendar::format(a.day, a.slot);
+        calendar.reserve(a.clinicianId, a.day, a.slot, a.slots);
+        appointments[a.id] = a;
+    }
+
+    // Book reserved slots (appMutex held)
+    int addAppointment(int patientId, int clinicianId, int day, int slot, int slots, const string& reason) {
+        int id = ++nextAppointmentId;
+        appointments[id] = {id, patientId, SlotCalendar::format(day, slot), reason, clinicianId, day, slot, slots, 0};
+        appointmentCount.set(appointments.size());
+        publishChange(ChangeOp::Created, appointments[id]);
+        queueReminders(appointments[id]);
+        return id;
+    }
+
+    // Hand freed slots to the waitlist. Without a dispatcher thread
+    // (--simulate) the caller backfills inline instead.
+    void releaseToWaitlist(int clinicianId, int day, int slot, int slots) {
+        if (waitlists.find({clinicianId, day}) == waitlists.end()) return;
+        FreedSlots f{clinicianId, day, slot, slots};
+        if (!reminderThread.joinable()) {
+            backfill(f);
+            return;
+        }
+        freed.push_back(f);
+        noteQueueDepth();
+        appointmentNotif.notify_all();
+    }
+
+    // Oldest waitlisted request no longer than `room` slots
+    static bool takeWaitlisted(map<int, deque<WaitlistEntry>>& buckets, int room, WaitlistEntry& out) {
+        auto best = buckets.end();
+        for (auto it = buckets.begin(); it != buckets.end() && it->first <= room; ++it) {
+            if (best == buckets.end() || it->second.front().id < best->second.front().id) best = it;
+        }
+        if (best == buckets.end()) return false;
+        out = best->second.front();
+        best->second.pop_front();
+        if (best->second.empty()) buckets.erase(best);
+        return true;
+    }
+
+    // Fill every free gap touching the freed slots from the waitlist,
+    // starting each booking as close to the freed time as fits (appMutex held)
+    void backfill(const FreedSlots& f) {
+        TRACE_SPAN("backfill");
+        auto wl = waitlists.find({f.clinicianId, f.day});
+        if (wl == waitlists.end()) return;
+
+        int pos = f.slot;
+        while (pos < f.slot + f.slots && !wl->second.empty()) {
+            int start, end;
+            if (!calendar.freeRun(f.clinicianId, f.day, pos, start, end)) {
+                ++pos;
+                continue;
+            }
+            WaitlistEntry e;
+            if (!takeWaitlisted(wl->second, end - start, e)) {
+                pos = end;
+                continue;
+            }
+            waitlistDepth.add(-1);
+            int at = min(pos, end - e.slots);
+            calendar.reserve(f.clinicianId, f.day, at, e.slots);
+            int id = addAppointment(e.patientId, f.clinicianId, f.day, at, e.slots, e.reason);
+            outbox.push_back("Waitlist: patient " + to_string(e.patientId) + " booked with clinician " +
+                             to_string(f.clinicianId) + " at " + SlotCalendar::format(f.day, at) +
+                             " (appointment " + to_string(id) + ")");
+            if (outbox.size() > OUTBOX_SIZE) outbox.pop_front();
+        }
+        if (wl->second.empty()) waitlists.erase(wl);
+    }
+
+    // Tell the caller where the clinician is next free (appMutex held)
+    void suggestSlot(int clinicianId, int day, int slot, int slots, ostream& out) {
+        int freeDay, freeSlot;
+        if (calendar.findEarliest(clinicianId, day, slot, slots, freeDay, freeSlot)) {
+            out << "Next free slot for clinician " << clinicianId << ": "
+                 << SlotCalendar::format(freeDay, freeSlot) << "\n";
+        }
+    }
+
+public:
+    ~AppointmentManager() {
+        if (!reminderThread.joinable()) return;
+        {
+            unique_lock lock(appMutex);
+            stopReminders = true;
+        }
+        appointmentNotif.notify_all();
+        reminderThread.join();
+    }
+
+    // Start the thread that sends reminders and backfills waitlists. Kept out
+    // of --simulate: it is a real thread and would share appMutex with
+    // simulated tasks.
+    void startDispatcher() {
+        reminderThread = thread(&AppointmentManager::dispatchReminders, this);
+    }
+
+    // Minutes before each appointment; applies to appointments booked or moved afterwards
+    void setReminderOffsets(const vector<int>& minutes, ostream& out = cout) {
+        unique_lock lock(appMutex);
+        reminderOffsets = minutes;
+        out << "Reminder offsets updated.\n";
+    }
+
+    // Print and clear the reminders and waitlist bookings so far
+    void showReminders(ostream& out = cout) {
+        unique_lock lock(appMutex);
+        if (outbox.empty()) {
+            out << "No notifications.\n";
+            return;
+        }
+        for (const auto& line : outbox) out << line << "\n";
+        outbox.clear();
+    }
+
+    // Schedule appointments
+    void scheduleAppointment(int patientId, int clinicianId, const string& datetime, int minutes, const string& reason, ostream& out = cout) {
+        TRACE_SPAN("scheduleAppointment");
+        metrics::Operation::Scope metered(scheduleOp);
+        int day, slot, slots = SlotCalendar::slotsFor(minutes);
+        if (!SlotCalendar::parse(datetime, day, slot) || slots < 1) {
+            out << "Invalid date/time. Use YYYY-MM-DD HH:MM in 15-minute steps.\n";
+            metered.error();
+            return;
+        }
+        lockMonitor.appointmentLock = true;
+        unique_lock lock(appMutex);
+        if (!calendar.reserve(clinicianId, day, slot, slots)) {
+            out << "Clinician " << clinicianId << " is already booked at that time.\n";
+            metered.error();
+            suggestSlot(clinicianId, day, slot, slots, out);
+            lockMonitor.appointmentLock = false;
+            return;
+        }
+        int id = addAppointment(patientId, clinicianId, day, slot, slots, reason);
+        out << "Appointment scheduled with ID " << id << ".\n";
+        appointmentNotif.notify_all();  // Notifies the system if there are waiting threads
+        lockMonitor.appointmentLock = false;
+    }
+
+    // Update EXISTING appointment
+    // Emphasis on existing
+    void updateAppointment(int id, const string& newDatetime, const string& newReason, ostream& out = cout) {
+        TRACE_SPAN("updateAppointment");
+        metrics::Operation::Scope metered(updateOp);
+        int day, slot;
+        if (!SlotCalendar::parse(newDatetime, day, slot)) {
+            out << "Invalid date/time. Use YYYY-MM-DD HH:MM in 15-minute steps.\n";
+            metered.error();
+            return;
+        }
+        if (appMutex.try_lock()) {
+            if (appointments.find(id) != appointments.end()) {
+                Appointment& appt = appointments[id];
+                // free the old slots first so a move can overlap them
+                calendar.release(appt.clinicianId, appt.day, appt.slot, appt.slots);
+                if (calendar.reserve(appt.clinicianId, day, slot, appt.slots)) {
+                    int oldDay = appt.day, oldSlot = appt.slot;
+                    appt.day = day;
+                    appt.slot = slot;
+                    appt.datetime = SlotCalendar::format(day, slot);
+                    appt.reason = newReason;
+                    ++appt.version;
+                    publishChange(ChangeOp::Updated, appt);
+                    queueReminders(appt);
+                    releaseToWaitlist(appt.clinicianId, oldDay, oldSlot, appt.slots);
+                    out << "Appointment updated.\n";
+                } else {
+                    calendar.reserve(appt.clinicianId, appt.day, appt.slot, appt.slots);
+                    out << "Clinician " << appt.clinicianId << " is already booked at that time.\n";
+                    suggestSlot(appt.clinicianId, day, slot, appt.slots, out);
+                    metered.error();
+                }
+            } else {
+                out << "Appointment not found.\n";
+                metered.error();
+            }
+            appMutex.unlock();
+        } else {
+            out << "Appointments are currently being updated. Try again later.\n";
+            metered.busy();
+        }
+    }
+
+    // Cancel/Remove Existing Appointment by ID
+    void cancelAppointment(int id, ostream& out = cout) {
+        TRACE_SPAN("cancelAppointment");
+        metrics::Operation::Scope metered(cancelOp);
+        lockMonitor.appointmentLock = true;
+        unique_lock lock(appMutex);
+        auto it = appointments.find(id);
+        if (it != appointments.end()) {
+            const Appointment& appt = it->second;
+            calendar.release(appt.clinicianId, appt.day, appt.slot, appt.slots);
+            publishChange(ChangeOp::Deleted, appt);
+            releaseToWaitlist(appt.clinicianId, appt.day, appt.slot, appt.slots);
+            appointments.erase(it);
+            appointmentCount.set(appointments.size());
+            out << "Appointment canceled.\n";
+        } else {
+            out << "Appointment not found.\n";
+            metered.error();
+        }
+        lockMonitor.appointmentLock = false;
+    }
+
+    // Wait for any opening of `minutes` with a clinician on a given day.
+    // The whole day is offered to the backfill right away, so a request
+    // that already fits is booked without waiting for a cancellation.
+    void joinWaitlist(int patientId, int clinicianId, const string& date, int minutes, const string& reason, ostream& out = cout) {
+        TRACE_SPAN("joinWaitlist");
+        metrics::Operation::Scope metered(waitlistOp);
+        int day, slot, slots = SlotCalendar::slotsFor(minutes);
+        if (!SlotCalendar::parse(date + " 00:00", day, slot) || slots < 1 || slots > SlotCalendar::SLOTS_PER_DAY) {
+            out << "Invalid input. Use YYYY-MM-DD and a duration within one day.\n";
+            metered.error();
+            return;
+        }
+        lockMonitor.appointmentLock = true;
+        unique_lock lock(appMutex);
+        int id = ++nextWaitlistId;
+        waitlists[{clinicianId, day}][slots].push_back({id, patientId, slots, reason});
+        waitlistDepth.add(1);
+        out << "Added to the waitlist as entry " << id << ". Bookings appear under View Notifications.\n";
+        releaseToWaitlist(clinicianId, day, 0, SlotCalendar::SLOTS_PER_DAY);
+        lockMonitor.appointmentLock = false;
+    }
+
+    // Earliest free slot of a clinician at or after a date/time
+    void findFreeSlot(int clinicianId, const string& from, int minutes, ostream& out = cout) {
+        TRACE_SPAN("findFreeSlot");
+        int day, slot, slots = SlotCalendar::slotsFor(minutes);
+        if (!SlotCalendar::parse(from, day, slot) || slots < 1) {
+            out << "Invalid date/time. Use YYYY-MM-DD HH:MM in 15-minute steps.\n";
+            return;
+        }
+        int freeDay, freeSlot;
+        if (calendar.findEarliest(clinicianId, day, slot, slots, freeDay, freeSlot)) {
+            out << "Next free " << minutes << "-minute slot for clinician " << clinicianId << ": "
+                 << SlotCalendar::format(freeDay, freeSlot) << "\n";
+        } else {
+            out << "No free slot within " << SlotCalendar::MAX_SEARCH_DAYS << " days.\n";
+        }
+    }
+
+    // Earliest slot over a set of clinicians (empty = all with bookings),
+    // between two date/times and inside daily hours. Runs on the search pool
+    // without appMutex, so it neither waits for nor delays bookings.
+    void findEarliestAcross(const vector<int>& clinicians, const string& from, const string& to,
+                            const string& dailyFrom, const string& dailyTo, int minutes, ostream& out = cout) {
+        TRACE_SPAN("findEarliestAcross");
+        SlotCalendar::Query q;
+        q.clinicians = clinicians;
+        q.slots = SlotCalendar::slotsFor(minutes);
+        if (!SlotCalendar::parse(from, q.fromDay, q.fromSlot) || !SlotCalendar::parse(to, q.toDay, q.toSlot) ||
+            !SlotCalendar::parseTime(dailyFrom, q.dayStart) || !SlotCalendar::parseTime(dailyTo, q.dayEnd) ||
+            q.slots < 1) {
+            out << "Invalid input. Use YYYY-MM-DD HH:MM and HH:MM in 15-minute steps.\n";
+            return;
+        }
+
+        uint64_t t0 = sim::nowNs();
+        // a simulated caller must stay on its own task to remain deterministic
+        WorkerPool* pool = sim::Scheduler::active() ? nullptr : &searchPool();
+        SlotCalendar::Match m = calendar.findEarliest(q, pool);
+        uint64_t elapsed = sim::nowNs() - t0;
+
+        if (m.found) {
+            out << "Earliest " << minutes << "-minute slot: clinician " << m.clinicianId << " at "
+                 << SlotCalendar::format(m.day, m.slot);
+        } else {
+            out << "No matching slot";
+        }
+        out << " (searched in " << elapsed / 1000 << " us)\n";
+    }
+
+    // Copy of every appointment; the result is the last sequence number it reflects
+    uint64_t copyRows(vector<Appointment>& rows) {
+        unique_lock lock(appMutex);
+        rows.reserve(appointments.size());
+        for (const auto& entry : appointments) rows.push_back(entry.second);
+        return changeStream.published();
+    }
+
+    // Current appointments as Created events; the result is the last
+    // sequence number they reflect
+    uint64_t snapshot(vector<ChangeEvent>& rows) {
+        unique_lock lock(appMutex);
+        for (const auto& [id, appt] : appointments) {
+            rows.push_back(changeEvent(ChangeOp::Created, appt));
+        }
+        return changeStream.published();
+    }
+
+    // Replace every appointment with a leader's snapshot (follower side)
+    void loadSnapshot(const vector<ChangeEvent>& rows) {
+        unique_lock lock(appMutex);
+        for (const auto& [id, appt] : appointments) {
+            calendar.release(appt.clinicianId, appt.day, appt.slot, appt.slots);
+        }
+        appointments.clear();
+        for (const auto& e : rows) applyLocked(e);
+        appointmentCount.set(appointments.size());
+    }
+
+    // Apply one leader change (follower side)
+    void applyChange(const ChangeEvent& e) {
+        lockMonitor.appointmentLock = true;
+        unique_lock lock(appMutex);
+        applyLocked(e);
+        appointmentCount.set(appointments.size());
+        lockMonitor.appointmentLock = false;
+    }
+
+    // List all EXISTING/scheduled appointments
+    void listAppointments(ostream& out = cout) {
+        TRACE_SPAN("listAppointments");
+        lockMonitor.appointmentLock = true;
+        unique_lock lock(appMutex);
+        for (const auto& [id, appt] : appointments) {
+            out << "ID: " << id << ", Patient ID: " << appt.patientId
+                 << ", Clinician: " << appt.clinicianId
+                 << ", DateTime: " << appt.datetime << " (" << appt.slots * SlotCalendar::SLOT_MINUTES << " min)"
+                 << ", Reason: " << appt.reason << "\n";
+        }
+        lockMonitor.appointmentLock = false;
+    }
+};
+
+// TRIAGE QUEUE
+// Walk-ins ordered by a static key, arrival minus a head start per severity
+// level, so a waiting low-severity patient eventually outranks new severe
+// ones without ever being re-keyed. The queue is a relaxed multi-queue:
+// many small heaps with their own locks; enqueue picks a random heap,
+// dequeue takes the better top of two random heaps. Callers only contend
+// when they collide on a heap, and the result is within a few places of
+// the exact priority order.
+struct WalkIn {
+    int id;
+    string name;
+    int severity;   // 1 = resuscitation ... 5 = non-urgent
+    chrono::steady_clock::time_point arrived;
+};
+
+class TriageQueue {
+public:
+    static constexpr int LEVELS = 5;
+    static constexpr int AGING_MINUTES = 15;   // head start per level above 5
+
+    explicit TriageQueue(unsigned shards = 2 * max(1u, thread::hardware_concurrency()))
+        : heaps(max(2u, shards)) {}
+
+    // Returns the walk-in's ticket number
+    int admit(const string& name, int severity) {
+        TRACE_SPAN("admitWalkIn");
+        severity = min(max(severity, 1), LEVELS);
+        WalkIn w{nextId.fetch_add(1) + 1, name, severity, chrono::steady_clock::now()};
+        int64_t key = chrono::duration_cast<chrono::milliseconds>(w.arrived.time_since_epoch()).count()
+                      - int64_t(LEVELS - severity) * AGING_MINUTES * 60 * 1000;
+
+        Level& lv = levels[severity - 1];
+        lv.waiting.fetch_add(1);   // before the push so depth never dips below zero
+        waitingGauge.add(1);
+        lv.admitted.fetch_add(1);
+
+        for (;;) {
+            Shard& h = heaps[pick()];
+            unique_lock lock(h.lock, try_to_lock);
+            if (!lock.owns_lock()) continue;
+            h.items.push({key, w});
+            h.top.store(h.items.top().key, memory_order_release);
+            break;
+        }
+        return w.id;
+    }
+
+    // Next walk-in for a clinician; false once every heap looked empty
+    bool callNext(WalkIn& out) {
+        TRACE_SPAN("callNextWalkIn");
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            size_t a = pick(), b = pick();
+            size_t best = heaps[a].top.load(memory_order_acquire) <= heaps[b].top.load(memory_order_acquire) ? a : b;
+            if (heaps[best].top.load(memory_order_acquire) == EMPTY) continue;
+            if (tryPop(heaps[best], out)) return finish(out);
+        }
+        // sampling kept missing; sweep every heap once before giving up
+        for (auto& h : heaps) {
+            if (h.top.load(memory_order_acquire) != EMPTY) {
+                unique_lock lock(h.lock);
+                if (popLocked(h, out)) return finish(out);
+            }
+        }
+        return false;
+    }
+
+    int depth() const {
+        int n = 0;
+        for (const auto& lv : levels) n += lv.waiting.load();
+        return n;
+    }
+
+    void report() const {
+        cout << "\n--- Triage Queue ---\n";
+        cout << "Waiting: " << depth() << "\n";
+        for (int i = 0; i < LEVELS; ++i) {
+            const Level& lv = levels[i];
+            long long seen = lv.seen.load();
+            cout << "Severity " << i + 1 << ": waiting " << lv.waiting.load()
+                 << ", admitted " << lv.admitted.load() << ", seen " << seen;
+            if (seen > 0) {
+                cout << ", avg wait " << lv.totalWaitMs.load() / seen << " ms"
+                     << ", max wait " << lv.maxWaitMs.load() << " ms";
+            }
+            cout << "\n";
+        }
+    }
+
+private:
+    static constexpr int64_t EMPTY = INT64_MAX;
+
+    struct Entry {
+        int64_t key;
+        WalkIn walkIn;
+        bool operator>(const Entry& o) const { return key > o.key; }
+    };
+
+    struct alignas(64) Shard {
+        sim::Mutex lock;
+        priority_queue<Entry, vector<Entry>, greater<>> items;
+        atomic<int64_t> top{EMPTY};   // cached for lock-free sampling
+    };
+
+    struct Level {
+        atomic<int> waiting{0};
+        atomic<long long> admitted{0};
+        atomic<long long> seen{0};
+        atomic<long long> totalWaitMs{0};
+        atomic<long long> maxWaitMs{0};
+    };
+
+    size_t pick() {
+        thread_local uint64_t state = hash<thread::id>()(this_thread::get_id()) | 1;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state % heaps.size();
+    }
+
+    bool tryPop(Shard& h, WalkIn& out) {
+        unique_lock lock(h.lock, try_to_lock);
+        return lock.owns_lock() && popLocked(h, out);
+    }
+
+    bool popLocked(Shard& h, WalkIn& out) {
+        if (h.items.empty()) return false;
+        out = h.items.top().walkIn;
+        h.items.pop();
+        h.top.store(h.items.empty() ? EMPTY : h.items.top().key, memory_order_release);
+        return true;
+    }
+
+    bool finish(const WalkIn& w) {
+        long long waited = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - w.arrived).count();
+        Level& lv = levels[w.severity - 1];
+        lv.waiting.fetch_sub(1);
+        waitingGauge.add(-1);
+        lv.seen.fetch_add(1);
+        lv.totalWaitMs.fetch_add(waited);
+        long long prev = lv.maxWaitMs.load();
+        while (waited > prev && !lv.maxWaitMs.compare_exchange_weak(prev, waited)) {
+        }
+        return true;
+    }
+
+    vector<Shard> heaps;
+    Level levels[LEVELS];
+    atomic<int> nextId{0};
+    metrics::Gauge& waitingGauge = metrics::gauge("triage_waiting", "Walk-ins waiting to be seen");
+};
+
+// RECORD MANAGER
+class RecordManager {
+private:
+    map<int, Record> records;
+    TRACE_LOCKABLE_ARGS(metrics::Metered<sim::Mutex>, recordMutex, "recordMutex");
+    metrics::Gauge& recordCount = metrics::gauge("records", "Patient records");
+    metrics::Operation addOp{"addRecord"}, updateOp{"updateRecord"}, viewOp{"viewRecord"};
+
+    // Records are only ever created and appended to (recordMutex held)
+    void applyLocked(const ChangeEvent& e) {
+        if (e.op == ChangeOp::Created) {
+            vector<string> f = ChangeStream::fields(e.data);
+            if (f.size() >= 2) records[e.key] = {e.key, f[0], atoi(f[1].c_str()), {}};
+        } else if (e.op == ChangeOp::Updated) {
+            auto it = records.find(e.key);
+            if (it != records.end()) it->second.entries.push_back(e.data);
+        } else {
+            records.erase(e.key);
+        }
+    }
+
+public:
+    // Add new patient record
+    void addRecord(int patientId, const string& name, int age, ostream& out = cout) {
+        TRACE_SPAN("addRecord");
+        metrics::Operation::Scope metered(addOp);
+        lockMonitor.recordLock = true;
+        unique_lock lock(recordMutex);
+        if (records.find(patientId) == records.end()) {
+            records[patientId] = {patientId, name, age, {}};
+            recordCount.set(records.size());
+            changeStream.publish(ChangeEntity::Record, ChangeOp::Created, patientId,
+                                 ChangeStream::field(name) + "\t" + to_string(age));
+            out << "Record created for Patient ID " << patientId << ".\n";
+        } else {
+            out << "Record already exists for this patient.\n";
+            metered.error();
+        }
+        lockMonitor.recordLock = false;
+    }
+
+    // Update EXISTING record
+    void updateRecord(int patientId, const string& entry, ostream& out = cout) {
+        TRACE_SPAN("updateRecord");
+        metrics::Operation::Scope metered(updateOp);
+        if (recordMutex.try_lock()) {
+            if (records.find(patientId) != records.end()) {
+                records[patientId].entries.push_back(entry);
+                changeStream.publish(ChangeEntity::Record, ChangeOp::Updated, patientId, entry);
+                out << "Medical record updated for Patient ID " << patientId << ".\n";
+            } else {
+                out << "No record found. Add one first.\n";
+                metered.error();
+            }
+            recordMutex.unlock();
+        } else {
+            out << "Record system is busy. Try again later.\n";
+            metered.busy();
+        }
+    }
+
+    // Copy of every record; the result is the last sequence number it reflects
+    uint64_t copyRows(vector<Record>& rows) {
+        unique_lock lock(recordMutex);
+        rows.reserve(records.size());
+        for (const auto& entry : records) rows.push_back(entry.second);
+        return changeStream.published();
+    }
+
+    // Current records as a Created event plus one Updated event per entry;
+    // the result is the last sequence number they reflect
+    uint64_t snapshot(vector<ChangeEvent>& rows) {
+        unique_lock lock(recordMutex);
+        for (const auto& [id, r] : records) {
+            rows.push_back({0, ChangeEntity::Record, ChangeOp::Created, id, ChangeStream::field(r.patientName) + "\t" + to_string(r.patientAge)});
+            for (const auto& entry : r.entries) {
+                rows.push_back({0, ChangeEntity::Record, ChangeOp::Updated, id, entry});
+            }
+        }
+        return changeStream.published();
+    }
+
+    // Replace every record with a leader's snapshot (follower side)
+    void loadSnapshot(const vector<ChangeEvent>& rows) {
+        unique_lock lock(recordMutex);
+        records.clear();
+        for (const auto& e : rows) applyLocked(e);
+        recordCount.set(records.size());
+    }
+
+    // Apply one leader change (follower side)
+    void applyChange(const ChangeEvent& e) {
+        lockMonitor.recordLock = true;
+        unique_lock lock(recordMutex);
+        applyLocked(e);
+        recordCount.set(records.size());
+        lockMonitor.recordLock = false;
+    }
+
+    // View EXISTING patient record by ID
+    void viewRecord(int patientId, ostream& out = cout) {
+        TRACE_SPAN("viewRecord");
+        metrics::Operation::Scope metered(viewOp);
+        lockMonitor.recordLock = true;
+        unique_lock lock(recordMutex);
+        if (records.find(patientId) != records.end()) {
+            const auto& r = records[patientId];
+            out << "Record for Patient ID " << patientId << ":\n";
+            out << "Name: " << r.patientName << ", Age: " << r.patientAge << "\n";
+            out << "Entries:\n";
+            for (const auto& entry : r.entries) {
+                out << "- " << entry << "\n";
+            }
+        } else {
+            out << "No records found for this patient.\n";
+            metered.error();
+        }
+        lockMonitor.recordLock = false;
+    }
+};
+// ANALYTICS
+// Management report over copies of the three managers. Each copy is taken
+// under its manager's lock, so it is consistent on its own and tagged with
+// the change stream position it reflects; nothing is held while the report
+// runs. The scan is split into chunks on the search pool, every chunk fills
+// its own partial aggregate, and the partials are merged once at the end.
+class Analytics {
+public:
+    Analytics(PatientManager& pm, AppointmentManager& am, RecordManager& rm)
+        : pm(pm), am(am), rm(rm) {}
+
+    void report(ostream& out = cout) {
+        TRACE_SPAN("analyticsReport");
+        uint64_t t0 = sim::nowNs();
+        vector<Patient> patients;
+        vector<Appointment> appointments;
+        vector<Record> records;
+        uint64_t patientMark = pm.copyRows(patients);
+        uint64_t appointmentMark = am.copyRows(appointments);
+        uint64_t recordMark = rm.copyRows(records);
+        uint64_t copied = sim::nowNs();
+
+        WorkerPool* pool = sim::Scheduler::active() ? nullptr : &searchPool();
+        int chunks = pool ? int(pool->size()) * 4 : 1;
+        vector<Partial> partials(chunks);
+        auto scan = [&](int chunk) {
+            Partial& p = partials[chunk];
+            for (size_t i = chunk; i < appointments.size(); i += chunks) p.add(appointments[i]);
+            for (size_t i = chunk; i < patients.size(); i += chunks) p.add(patients[i]);
+            for (size_t i = chunk; i < records.size(); i += chunks) p.add(records[i]);
+        };
+        if (pool) pool->parallelFor(chunks, scan);
+        else scan(0);
+
+        Partial total;
+        for (const auto& p : partials) total.merge(p);
+        uint64_t scanned = sim::nowNs();
+
+        out << "\n--- Analytics Report ---\n";
+        out << "Snapshot: patients as of #" << patientMark << ", appointments as of #" << appointmentMark
+            << ", records as of #" << recordMark << "\n";
+        printAppointments(total, out);
+        printAges(total, out);
+        printRecords(total, out);
+        out << "Copied in " << (copied - t0) / 1000 << " us, scanned in " << (scanned - copied) / 1000
+            << " us over " << chunks << " chunks\n";
+    }
+
+private:
+    static constexpr int AGE_BUCKETS = 10;   // decades, the last one open-ended
+    static constexpr int TOP = 10;
+
+    // One chunk's share of every aggregate
+    struct Partial {
+        unordered_map<int, int> perDay;
+        int perHour[24] = {};
+        unordered_map<string, int> reasons;
+        long long appointmentMinutes = 0;
+        int appointments = 0;
+
+        int ages[AGE_BUCKETS] = {};
+        long long ageSum = 0;
+        int patients = 0, minAge = INT_MAX, maxAge = INT_MIN;
+
+        int entryBuckets[5] = {};   // 0, 1, 2-4, 5-9, 10+ entries per record
+        long long entries = 0;
+        int records = 0, maxEntries = 0;
+
+        void add(const Appointment& a) {
+            ++appointments;
+            ++perDay[a.day];
+            ++perHour[a.slot * SlotCalendar::SLOT_MINUTES / 60];
+            appointmentMinutes += a.slots * SlotCalendar::SLOT_MINUTES;
+            ++reasons[normalize(a.reason)];
+        }
+
+        void add(const Patient& p) {
+            ++patients;
+            ++ages[min(max(p.age, 0) / 10, AGE_BUCKETS - 1)];
+            ageSum += p.age;
+            minAge = min(minAge, p.age);
+            maxAge = max(maxAge, p.age);
+        }
+
+        void add(const Record& r) {
+            int n = int(r.entries.size());
+            ++records;
+            entries += n;
+            maxEntries = max(maxEntries, n);
+            ++entryBuckets[n == 0 ? 0 : n == 1 ? 1 : n < 5 ? 2 : n < 10 ? 3 : 4];
+        }
+
+        void merge(const Partial& o) {
+            for (const auto& [day, n] : o.perDay) perDay[day] += n;
+            for (int h = 0; h < 24; ++h) perHour[h] += o.perHour[h];
+            for (const auto& [reason, n] : o.reasons) reasons[reason] += n;
+            appointmentMinutes += o.appointmentMinutes;
+            appointments += o.appointments;
+
+            for (int b = 0; b < AGE_BUCKETS; ++b) ages[b] += o.ages[b];
+            ageSum += o.ageSum;
+            patients += o.patients;
+            minAge = min(minAge, o.minAge);
+            maxAge = max(maxAge, o.maxAge);
+
+            for (int b = 0; b < 5; ++b) entryBuckets[b] += o.entryBuckets[b];
+            entries += o.entries;
+            records += o.records;
+            maxEntries = max(maxEntries, o.maxEntries);
+        }
+    };
+
+    // Reasons are counted case- and whitespace-insensitively
+    static string normalize(const string& reason) {
+        size_t first = reason.find_first_not_of(" \t");
+        if (first == string::npos) return "(none)";
+        size_t last = reason.find_last_not_of(" \t");
+        string r = reason.substr(first, last - first + 1);
+        transform(r.begin(), r.end(), r.begin(), [](unsigned char c) { return char(tolower(c)); });
+        return r;
+    }
+
+    template <typename Key>
+    static vector<pair<Key, int>> top(const unordered_map<Key, int>& counts) {
+        vector<pair<Key, int>> sorted(counts.begin(), counts.end());
+        sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        if (sorted.size() > size_t(TOP)) sorted.resize(TOP);
+        return sorted;
+    }
+
+    static void printAppointments(const Partial& t, ostream& out) {
+        out << "\nAppointments: " << t.appointments;
+        if (t.appointments > 0) {
+            out << " (" << t.appointmentMinutes / 60 << " h booked over " << t.perDay.size() << " days)";
+        }
+        out << "\n";
+        if (t.appointments == 0) return;
+
+        out << "Busiest days:\n";
+        for (const auto& [day, n] : top(t.perDay)) {
+            out << "  " << SlotCalendar::format(day, 0).substr(0, 10) << "  " << n << "\n";
+        }
+        out << "By start hour:\n";
+        for (int h = 0; h < 24; ++h) {
+            if (t.perHour[h] == 0) continue;
+            char hour[8];
+            snprintf(hour, sizeof(hour), "%02d:00", h);
+            out << "  " << hour << "  " << t.perHour[h] << "\n";
+        }
+        out << "Top reasons:\n";
+        for (const auto& [reason, n] : top(t.reasons)) out << "  " << reason << "  " << n << "\n";
+    }
+
+    static void printAges(const Partial& t, ostream& out) {
+        out << "\nPatients: " << t.patients;
+        if (t.patients == 0) {
+            out << "\n";
+            return;
+        }
+        out << " (age " << t.minAge << "-" << t.maxAge << ", mean " << t.ageSum / t.patients << ")\n";
+        for (int b = 0; b < AGE_BUCKETS; ++b) {
+            if (t.ages[b] == 0) continue;
+            string label = b == AGE_BUCKETS - 1 ? to_string(b * 10) + "+" : to_string(b * 10) + "-" + to_string(b * 10 + 9);
+            out << "  " << label << "  " << t.ages[b] << "\n";
+        }
+    }
+
+    void printRecords(const Partial& t, ostream& out) {
+        static const char* labels[] = {"0", "1", "2-4", "5-9", "10+"};
+        out << "\nRecords: " << t.records << " with " << t.entries << " entries";
+        if (t.records > 0) out << " (max " << t.maxEntries << " in one record)";
+        // growth is measured between reports, since entries carry no time
+        lock_guard<mutex> lock(growthMutex);
+        long long added = t.entries - lastEntries;
+        double seconds = lastReport.time_since_epoch().count() == 0
+                             ? 0 : chrono::duration<double>(chrono::steady_clock::now() - lastReport).count();
+        if (seconds > 0) out << ", " << (added >= 0 ? "+" : "") << added << " since last report " << int(seconds) << " s ago";
+        out << "\n";
+        for (int b = 0; b < 5; ++b) {
+            if (t.entryBuckets[b] > 0) out << "  " << labels[b] << " entries  " << t.entryBuckets[b] << "\n";
+        }
+        lastEntries = t.entries;
+        lastReport = chrono::steady_clock::now();
+    }
+
+    PatientManager& pm;
+    AppointmentManager& am;
+    RecordManager& rm;
+    mutex growthMutex;   // reports may run concurrently (server workers)
+    long long lastEntries = 0;
+    chrono::steady_clock::time_point lastReport{};
+};
+
+// REPLICATION
+// A leader ships the change stream to follower processes over a Unix
+// socket. Each follower connection starts with a snapshot of the three
+// managers, then streams every later event. Each manager's snapshot is
+// taken under its own lock and tagged with the last sequence number it
+// reflects, so the follower skips tail events it already has. A follower
+// that falls a full ring behind simply gets a fresh snapshot.
+//
+// Line protocol, leader to follower:
+//   SNAPSHOT                                  start of a full resync
+//   E <seq> <entity> <op> <key> <data>        event; snapshot rows use seq 0, data
+//                                             escaped so it never holds a raw newline
+//   MARK <entity> <seq>                       end of one manager's snapshot
+//   END                                       snapshot done, the tail follows
+//   H <sent> <published>                      heartbeat: last event sent, leader's head
+string encodeEvent(const ChangeEvent& e) {
+    return "E " + to_string(e.seq) + " " + to_string(int(e.entity)) + " " + to_string(int(e.op)) + " " +
+           to_string(e.key) + " " + ChangeStream::escape(e.data) + "\n";
+}
+
+bool decodeEvent(const string& line, ChangeEvent& e) {
+    unsigned long long seq;
+    int entity, op, key, used = 0;
+    if (sscanf(line.c_str(), "E %llu %d %d %d%n", &seq, &entity, &op, &key, &used) != 4 || used == 0) return false;
+    if (size_t(used) >= line.size() || line[used] != ' ') return false;
+    if (entity < 0 || entity > 2 || op < 0 || op > 2) return false;
+    e = {seq, ChangeEntity(entity), ChangeOp(op), key, ChangeStream::unescape(line.substr(used + 1))};
+    return true;
+}
+
+// Whole buffer or nothing; false once the peer is gone. On a non-blocking
+// socket it waits for room in 100 ms polls, and gives up once `stop` is set
+// or the peer has taken nothing for `stall`.
+bool sendAll(int fd, const string& data, const atomic<bool>* stop = nullptr,
+             chrono::milliseconds stall = chrono::seconds(10)) {
+    size_t sent = 0;
+    auto lastProgress = chrono::steady_clock::now();
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += size_t(n);
+            lastProgress = chrono::steady_clock::now();
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) return false;
+        if ((stop && stop->load()) || chrono::steady_clock::now() - lastProgress > stall) return false;
+        pollfd p{fd, POLLOUT, 0};
+        poll(&p, 1, 100);
+    }
+    return true;
+}
+
+class ReplicationLeader {
+public:
+    ReplicationLeader(PatientManager& pm, AppointmentManager& am, RecordManager& rm)
+        : pm(pm), am(am), rm(rm) {}
+
+    ~ReplicationLeader() {
+        stopping = true;
+        if (acceptThread.joinable()) acceptThread.join();
+        for (auto& s : senders) s.worker.join();
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(path.c_str());
+        }
+    }
+
+    bool start(const string& socketPath) {
+        sockaddr_un addr{};
+        if (socketPath.size() >= sizeof(addr.sun_path)) return false;
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, socketPath.c_str());
+        unlink(socketPath.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || ::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 8) < 0) {
+            return false;
+        }
+        path = socketPath;
+        acceptThread = thread(&ReplicationLeader::acceptFollowers, this);
+        return true;
+    }
+
+private:
+    struct Sender {
+        thread worker;
+        atomic<bool> finished{false};
+    };
+
+    // Follower sockets are non-blocking, so a follower that stops reading
+    // can't wedge its sender past shutdown or the stall limit
+    void acceptFollowers() {
+        while (!stopping) {
+            reapSenders();
+            pollfd p{listenFd, POLLIN, 0};
+            if (poll(&p, 1, 100) <= 0) continue;
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) continue;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            Sender& s = senders.emplace_back();
+            s.worker = thread([this, &s, fd, number = ++followerCount]() {
+                serve(fd, number);
+                s.finished = true;
+            });
+        }
+    }
+
+    // Join the senders whose follower went away
+    void reapSenders() {
+        for (auto it = senders.begin(); it != senders.end();) {
+            if (it->finished.load()) {
+                it->worker.join();
+                it = senders.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // One follower: snapshot, then the tail, resyncing whenever it falls
+    // too far behind
+    void serve(int fd, int number) {
+        TRACE_THREAD_NAME("replication sender");
+        bool connected = true;
+        while (connected && !stopping) {
+            auto sub = changeStream.subscribe("follower " + to_string(number));
+            connected = sendAll(fd, snapshot(), &stopping);
+            uint64_t dropped = 0;
+            auto lastSend = chrono::steady_clock::now();
+
+            vector<ChangeEvent> events;
+            while (connected && !stopping && sub->dropped.load() == dropped) {
+                events.clear();
+                changeStream.poll(*sub, events, 256);
+                string batch;
+                for (const auto& e : events) batch += encodeEvent(e);
+                if (chrono::steady_clock::now() - lastSend > chrono::milliseconds(100)) {
+                    batch += "H " + to_string(sub->next.load() - 1) + " " + to_string(changeStream.published()) + "\n";
+                }
+                if (!batch.empty()) {
+                    connected = sendAll(fd, batch, &stopping);
+                    lastSend = chrono::steady_clock::now();
+                }
+                if (events.empty()) this_thread::sleep_for(chrono::milliseconds(5));
+            }
+            changeStream.unsubscribe(sub);
+        }
+        close(fd);
+    }
+
+    string snapshot() {
+        string out = "SNAPSHOT\n";
+        auto add = [&](ChangeEntity entity, vector<ChangeEvent>& rows, uint64_t mark) {
+            for (const auto& e : rows) out += encodeEvent(e);
+            out += "MARK " + to_string(int(entity)) + " " + to_string(mark) + "\n";
+        };
+        vector<ChangeEvent> patients, appointments, records;
+        add(ChangeEntity::Patient, patients, pm.snapshot(patients));
+        add(ChangeEntity::Appointment, appointments, am.snapshot(appointments));
+        add(ChangeEntity::Record, records, rm.snapshot(records));
+        return out + "END\n";
+    }
+
+    PatientManager& pm;
+    AppointmentManager& am;
+    RecordManager& rm;
+    string path;
+    int listenFd = -1;
+    atomic<bool> stopping{false};
+    thread acceptThread;
+    list<Sender> senders;   // only touched by the accept thread until shutdown
+    int followerCount = 0;
+};
+
+class ReplicationFollower {
+public:
+    ReplicationFollower(PatientManager& pm, AppointmentManager& am, RecordManager& rm)
+        : pm(pm), am(am), rm(rm) {}
+
+    ~ReplicationFollower() {
+        stopping = true;
+        if (worker.joinable()) worker.join();
+    }
+
+    // Connects in the background and keeps reconnecting
+    void start(const string& socketPath) {
+        path = socketPath;
+        worker = thread(&ReplicationFollower::run, this);
+    }
+
+    void report() {
+        uint64_t applied = appliedSeq.load(), head = leaderHead.load();
+        cout << "\n--- Replication Status ---\n";
+        cout << "Leader: " << path << " (" << (connected.load() ? "connected" : "disconnected") << ")\n";
+        cout << "Snapshots loaded: " << snapshots.load() << ", events applied: " << eventsApplied.load() << "\n";
+        cout << "Applied up to #" << applied << ", leader at #" << head
+             << ", lag " << (head > applied ? head - applied : 0) << " events";
+        if (lastContactNs.load() > 0) {
+            auto now = chrono::steady_clock::now().time_since_epoch();
+            long long ago = (chrono::duration_cast<chrono::nanoseconds>(now).count() - lastContactNs.load()) / 1000000;
+            cout << ", last heard " << ago << " ms ago";
+        }
+        cout << "\n";
+    }
+
+private:
+    void run() {
+        TRACE_THREAD_NAME("replication receiver");
+        while (!stopping) {
+            int fd = connectLeader();
+            if (fd < 0) {
+                this_thread::sleep_for(chrono::milliseconds(500));
+                continue;
+            }
+            connected = true;
+            follow(fd);
+            connected = false;
+            close(fd);
+        }
+    }
+
+    int connectLeader() {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) return -1;
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    void follow(int fd) {
+        string buffer;
+        char chunk[65536];
+        while (!stopping) {
+            pollfd p{fd, POLLIN, 0};
+            if (poll(&p, 1, 100) <= 0) continue;
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) return;
+            lastContactNs = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+            buffer.append(chunk, size_t(n));
+
+            size_t start = 0, end;
+            while ((end = buffer.find('\n', start)) != string::npos) {
+                handle(buffer.substr(start, end - start));
+                start = end + 1;
+            }
+            buffer.erase(0, start);
+        }
+    }
+
+    void handle(const string& line) {
+        ChangeEvent e;
+        if (decodeEvent(line, e)) {
+            if (loading) {
+                pending[int(e.entity)].push_back(move(e));
+                return;
+            }
+            if (e.seq > marks[int(e.entity)]) {
+                if (e.entity == ChangeEntity::Patient) pm.applyChange(e);
+                else if (e.entity == ChangeEntity::Appointment) am.applyChange(e);
+                else rm.applyChange(e);
+                eventsApplied.fetch_add(1);
+            }
+            appliedSeq = max(appliedSeq.load(), e.seq);
+            leaderHead = max(leaderHead.load(), e.seq);
+            return;
+        }
+
+        int entity;
+        unsigned long long seq, head;
+        if (line == "SNAPSHOT") {
+            loading = true;
+            for (auto& rows : pending) rows.clear();
+            for (auto& mark : marks) mark = 0;
+            appliedSeq = 0;
+            leaderHead = 0;
+        } else if (sscanf(line.c_str(), "MARK %d %llu", &entity, &seq) == 2 && entity >= 0 && entity <= 2) {
+            // each manager swaps in its whole snapshot at once
+            if (entity == int(ChangeEntity::Patient)) pm.loadSnapshot(pending[entity]);
+            else if (entity == int(ChangeEntity::Appointment)) am.loadSnapshot(pending[entity]);
+            else rm.loadSnapshot(pending[entity]);
+            pending[entity].clear();
+            marks[entity] = seq;
+        } else if (line == "END") {
+            loading = false;
+            snapshots.fetch_add(1);
+            appliedSeq = *min_element(marks, marks + 3);
+        } else if (sscanf(line.c_str(), "H %llu %llu", &seq, &head) == 2) {
+            // everything up to `seq` has arrived and been handled in order
+            appliedSeq = max(appliedSeq.load(), uint64_t(seq));
+            leaderHead = head;
+        }
+    }
+
+    PatientManager& pm;
+    AppointmentManager& am;
+    RecordManager& rm;
+    string path;
+    atomic<bool> stopping{false};
+    atomic<bool> connected{false};
+    thread worker;
+
+    // worker thread only
+    bool loading = false;
+    vector<ChangeEvent> pending[3];
+    uint64_t marks[3] = {0, 0, 0};
+
+    // read by report()
+    atomic<uint64_t> appliedSeq{0};
+    atomic<uint64_t> leaderHead{0};
+    atomic<uint64_t> eventsApplied{0};
+    atomic<uint64_t> snapshots{0};
+    atomic<long long> lastContactNs{0};
+};
+// SOCKET SERVER
+// Every manager operation over TCP. One epoll thread owns the sockets;
+// requests are parsed there and handed to the worker pool one connection
+// at a time, so a connection's requests run in the order they were sent
+// while different connections run in parallel. Clients may pipeline as
+// many requests as they like. Finished responses go back to the epoll
+// thread through an eventfd and leave in as few writev calls as possible.
+//
+// Frames, little-endian:
+//   request   u32 length | u32 request id | u8 op | fields
+//   response  u32 length | u32 request id | u8 status | text
+// `length` counts the bytes after itself. Fields are i32 numbers and
+// strings as u16 length + bytes. The response text is what the menu would
+// have printed.
+enum class ServerOp : uint8_t {
+    RegisterPatient = 1,   // name, age
+    UpdatePatient,         // id, name, age
+    RemovePatient,         // id
+    ListPatients,
+    ScheduleAppointment,   // patientId, clinicianId, datetime, minutes, reason
+    UpdateAppointment,     // id, datetime, reason
+    CancelAppointment,     // id
+    ListAppointments,
+    FindFreeSlot,          // clinicianId, from, minutes
+    FindEarliestAcross,    // clinician IDs (comma-separated), from, to, dailyFrom, dailyTo, minutes
+    JoinWaitlist,          // patientId, clinicianId, date, minutes, reason
+    ShowNotifications,
+    SetReminderOffsets,    // minutes (comma-separated)
+    AddRecord,             // patientId, name, age
+    UpdateRecord,          // patientId, entry
+    ViewRecord,            // patientId
+    LockStatus,
+    CheckDeadlocks,
+    AdmitWalkIn,           // name, severity
+    CallNextWalkIn,
+    AnalyticsReport,
+};
+
+enum ServerStatus : uint8_t { STATUS_OK = 0, STATUS_BAD_REQUEST = 1 };
+
+struct FrameWriter {
+    string bytes;
+
+    void u8(uint8_t v) { bytes += char(v); }
+    void u32(uint32_t v) {
+        for (int i = 0; i < 4; ++i) bytes += char((v >> (8 * i)) & 0xff);
+    }
+    void i32(int32_t v) { u32(uint32_t(v)); }
+    void str(const string& v) {
+        size_t n = min<size_t>(v.size(), 0xffff);
+        bytes += char(n & 0xff);
+        bytes += char(n >> 8);
+        bytes.append(v, 0, n);
+    }
+    // Prefix everything written so far with its length
+    string frame() const {
+        FrameWriter out;
+        out.u32(uint32_t(bytes.size()));
+        return out.bytes + bytes;
+    }
+};
+
+struct FrameReader {
+    const char* p;
+    size_t left;
+    bool ok = true;
+
+    uint32_t u32() {
+        if (left < 4) return fail();
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= uint32_t(uint8_t(p[i])) << (8 * i);
+        p += 4;
+        left -= 4;
+        return v;
+    }
+    uint8_t u8() {
+        if (left < 1) return fail();
+        left -= 1;
+        return uint8_t(*p++);
+    }
+    int32_t i32() { return int32_t(u32()); }
+    string str() {
+        if (left < 2) return fail(), "";
+        size_t n = uint8_t(p[0]) | size_t(uint8_t(p[1])) << 8;
+        if (left < 2 + n) return fail(), "";
+        string v(p + 2, n);
+        p += 2 + n;
+        left -= 2 + n;
+        return v;
+    }
+
+private:
+    uint32_t fail() {
+        ok = false;
+        left = 0;
+        return 0;
+    }
+};
+
+vector<int> parseIdList(const string& csv) {
+    vector<int> ids;
+    stringstream list(csv);
+    string item;
+    while (getline(list, item, ',')) {
+        if (item.find_first_not_of(" ") != string::npos) ids.push_back(atoi(item.c_str()));
+    }
+    return ids;
+}
+
+class HospitalServer {
+public:
+    static constexpr uint32_t MAX_FRAME = 1 << 20;
+    static constexpr size_t MAX_PENDING_OUTPUT = 64 << 20;   // a client that stops reading is dropped
+
+    HospitalServer(PatientManager& pm, AppointmentManager& am, RecordManager& rm, TriageQueue& triage, unsigned workers)
+        : pm(pm), am(am), rm(rm), triage(triage), analytics(pm, am, rm), pool(max(1u, workers)) {}
+
+    // Serve until SIGINT/SIGTERM; returns the process exit code
+    int run(int port) {
+        int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int yes = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(uint16_t(port));
+        if (listenFd < 0 || ::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 512) < 0) {
+            cout << "Could not listen on port " << port << ".\n";
+            if (listenFd >= 0) close(listenFd);
+            return 1;
+        }
+
+        epollFd = epoll_create1(0);
+        wakeFd = eventfd(0, EFD_NONBLOCK);
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+
+        stopRequested = false;
+        signal(SIGINT, [](int) { stopRequested = true; });
+        signal(SIGTERM, [](int) { stopRequested = true; });
+        signal(SIGPIPE, SIG_IGN);
+        cout << "Serving on 127.0.0.1:" << port << " with " << pool.size() - 1
+             << " workers. Ctrl+C to stop.\n" << flush;
+
+        TRACE_THREAD_NAME("epoll loop");
+        epoll_event events[256];
+        while (!stopRequested) {
+            int n = epoll_wait(epollFd, events, 256, 200);
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) acceptClients(listenFd);
+                else if (fd == wakeFd) collectResponses();
+                else handle(fd, events[i].events);
+            }
+        }
+
+        // let queued work finish so no worker touches a dead server
+        while (busyConnections.load() > 0) this_thread::sleep_for(chrono::milliseconds(10));
+        for (auto& [fd, c] : connections) close(fd);
+        close(listenFd);
+        close(wakeFd);
+        close(epollFd);
+
+        cout << "\n--- Server Summary ---\n";
+        cout << "Connections: " << accepted << ", requests: " << requests.load()
+             << ", writev calls: " << writevCalls << ", responses per writev: "
+             << (writevCalls ? double(responsesSent) / writevCalls : 0.0) << "\n";
+        return 0;
+    }
+
+private:
+    struct Request {
+        uint32_t id;
+        string body;   // op and fields
+    };
+
+    struct Connection {
+        int fd;
+        // epoll thread only
+        string in;
+        deque<string> out;
+        size_t outOffset = 0;
+        size_t outBytes = 0;
+        bool writing = false;   // EPOLLOUT registered
+        bool closed = false;
+
+        mutex lock;   // guards the rest
+        deque<Request> requests;
+        vector<string> responses;
+        bool running = false;   // a worker is draining `requests`
+    };
+
+    static inline atomic<bool> stopRequested{false};
+
+    void watch(int fd, uint32_t events, int op) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, op, fd, &ev);
+    }
+
+    void acceptClients(int listenFd) {
+        for (;;) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK);
+            if (fd < 0) return;
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            auto c = make_shared<Connection>();
+            c->fd = fd;
+            connections[fd] = c;
+            connectionCount.set(connections.size());
+            watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+            ++accepted;
+        }
+    }
+
+    void handle(int fd, uint32_t events) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) return;
+        shared_ptr<Connection> c = it->second;
+
+        if (events & EPOLLOUT) sendPending(*c);
+        if (!c->closed && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) readRequests(c);
+    }
+
+    // Read everything available, queue every complete frame, and wake a
+    // worker if none is draining this connection yet
+    void readRequests(const shared_ptr<Connection>& c) {
+        char chunk[65536];
+        bool peerClosed = false;
+        for (;;) {
+            ssize_t n = recv(c->fd, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                c->in.append(chunk, size_t(n));
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) peerClosed = true;
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+
+        deque<Request> parsed;
+        size_t pos = 0;
+        while (c->in.size() - pos >= 4) {
+            FrameReader header{c->in.data() + pos, 4};
+            uint32_t length = header.u32();
+            if (length < 5 || length > MAX_FRAME) {
+                peerClosed = true;
+                break;
+            }
+            if (c->in.size() - pos - 4 < length) break;
+            FrameReader id{c->in.data() + pos + 4, 4};
+            parsed.push_back({id.u32(), c->in.substr(pos + 8, length - 4)});
+            pos += 4 + length;
+        }
+        c->in.erase(0, pos);
+
+        if (!parsed.empty()) {
+            requests.fetch_add(parsed.size());
+            queuedRequests.add(parsed.size());
+            bool start;
+            {
+                lock_guard<mutex> lock(c->lock);
+                for (auto& r : parsed) c->requests.push_back(move(r));
+                start = !c->running;
+                c->running = true;
+            }
+            if (start) {
+                busyConnections.fetch_add(1);
+                pool.submit([this, c]() { drain(c); });
+            }
+        }
+        if (peerClosed) closeConnection(*c);
+    }
+
+    // Worker side: run queued requests in order until none are left
+    void drain(const shared_ptr<Connection>& c) {
+        for (;;) {
+            deque<Request> batch;
+            {
+                lock_guard<mutex> lock(c->lock);
+                if (c->requests.empty()) {
+                    c->running = false;
+                    break;
+                }
+                batch.swap(c->requests);
+            }
+            queuedRequests.add(-int64_t(batch.size()));
+            vector<string> done;
+            done.reserve(batch.size());
+            for (const auto& r : batch) done.push_back(execute(r));
+            {
+                lock_guard<mutex> lock(c->lock);
+                for (auto& d : done) c->responses.push_back(move(d));
+            }
+            {
+                lock_guard<mutex> lock(readyMutex);
+                ready.push_back(c);
+            }
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeFd, &one, sizeof(one));
+            (void)ignored;
+        }
+        busyConnections.fetch_sub(1);
+    }
+
+    string execute(const Request& r) {
+        FrameReader in{r.body.data(), r.body.size()};
+        ServerOp op = ServerOp(in.u8());
+        ostringstream out;
+        switch (op) {
+        case ServerOp::RegisterPatient: {
+            string name = in.str();
+            int age = in.i32();
+            if (in.ok) pm.registerPatient(name, age, out);
+            break;
+        }
+        case ServerOp::UpdatePatient: {
+            int id = in.i32();
+            string name = in.str();
+            int age = in.i32();
+            if (in.ok) pm.updatePatient(id, name, age, out);
+            break;
+        }
+        case ServerOp::RemovePatient: {
+            int id = in.i32();
+            if (in.ok) pm.removePatient(id, out);
+            break;
+        }
+        case ServerOp::ListPatients:
+            pm.listPatient(out);
+            break;
+        case ServerOp::ScheduleAppointment: {
+            int patientId = in.i32(), clinicianId = in.i32();
+            string datetime = in.str();
+            int minutes = in.i32();
+            string reason = in.str();
+            if (in.ok) am.scheduleAppointment(patientId, clinicianId, datetime, minutes, reason, out);
+            break;
+        }
+        case ServerOp::UpdateAppointment: {
+            int id = in.i32();
+            string datetime = in.str(), reason = in.str();
+            if (in.ok) am.updateAppointment(id, datetime, reason, out);
+            break;
+        }
+        case ServerOp::CancelAppointment: {
+            int id = in.i32();
+            if (in.ok) am.cancelAppointment(id, out);
+            break;
+        }
+        case ServerOp::ListAppointments:
+            am.listAppointments(out);
+            break;
+        case ServerOp::FindFreeSlot: {
+            int clinicianId = in.i32();
+            string from = in.str();
+            int minutes = in.i32();
+            if (in.ok) am.findFreeSlot(clinicianId, from, minutes, out);
+            break;
+        }
+        case ServerOp::FindEarliestAcross: {
+            string ids = in.str(), from = in.str(), to = in.str(), dailyFrom = in.str(), dailyTo = in.str();
+            int minutes = in.i32();
+            if (in.ok) am.findEarliestAcross(parseIdList(ids), from, to, dailyFrom, dailyTo, minutes, out);
+            break;
+        }
+        case ServerOp::JoinWaitlist: {
+            int patientId = in.i32(), clinicianId = in.i32();
+            string date = in.str();
+            int minutes = in.i32();
+            string reason = in.str();
+            if (in.ok) am.joinWaitlist(patientId, clinicianId, date, minutes, reason, out);
+            break;
+        }
+        case ServerOp::ShowNotifications:
+            am.showReminders(out);
+            break;
+        case ServerOp::SetReminderOffsets: {
+            string offsets = in.str();
+            vector<int> minutes;
+            for (int m : parseIdList(offsets)) {
+                if (m > 0) minutes.push_back(m);
+            }
+            if (in.ok) am.setReminderOffsets(minutes, out);
+            break;
+        }
+        case ServerOp::AddRecord: {
+            int patientId = in.i32();
+            string name = in.str();
+            int age = in.i32();
+            if (in.ok) rm.addRecord(patientId, name, age, out);
+            break;
+        }
+        case ServerOp::UpdateRecord: {
+            int patientId = in.i32();
+            string entry = in.str();
+            if (in.ok) rm.updateRecord(patientId, entry, out);
+            break;
+        }
+        case ServerOp::ViewRecord: {
+            int patientId = in.i32();
+            if (in.ok) rm.viewRecord(patientId, out);
+            break;
+        }
+        case ServerOp::LockStatus:
+            lockMonitor.displayLockStatus(out);
+            break;
+        case ServerOp::CheckDeadlocks:
+            lockMonitor.checkDeadlocks(out);
+            break;
+        case ServerOp::AdmitWalkIn: {
+            string name = in.str();
+            int severity = in.i32();
+            if (in.ok) out << "Walk-in admitted with ticket " << triage.admit(name, severity) << ".\n";
+            break;
+        }
+        case ServerOp::AnalyticsReport:
+            analytics.report(out);
+            break;
+        case ServerOp::CallNextWalkIn: {
+            WalkIn next;
+            if (triage.callNext(next)) {
+                out << "Next: ticket " << next.id << ", " << next.name << " (severity " << next.severity << ")\n";
             } else {
-                cout << "Appointment not found.\n";
+                out << "No walk-ins waiting.\n";
             }
-            appMutex.unlock();
-        } else {
-            cout << "Appointments are currently being updated. Try again later.\n";
+            break;
         }
-    }
-
-    // Cancel/Remove Existing Appointment by ID
-    void cancelAppointment(int id) {
-        lockMonitor.appointmentLock = true;
-        unique_lock lock(appMutex);
-        if (appointments.erase(id)) {
-            cout << "Appointment canceled.\n";
-        } else {
-            cout << "Appointment not found.\n";
+        default:
+            in.ok = false;
         }
-        lockMonitor.appointmentLock = false;
-    }
 
-    // List all EXISTING/scheduled appointments
-    void listAppointments() {
-        lockMonitor.appointmentLock = true;
-        unique_lock lock(appMutex);
-        for (const auto& [id, appt] : appointments) {
-            cout << "ID: " << id << ", Patient ID: " << appt.patientId
-                 << ", DateTime: " << appt.datetime << ", Reason: " << appt.reason << "\n";
-        }
-        lockMonitor.appointmentLock = false;
+        FrameWriter response;
+        response.u32(r.id);
+        response.u8(in.ok ? STATUS_OK : STATUS_BAD_REQUEST);
+        response.bytes += in.ok ? out.str() : "Malformed request.\n";
+        return response.frame();
     }
-};
 
-// RECORD MANAGER
-class RecordManager {
-private:
-    map<int, Record> records;
-    mutex recordMutex;
+    // Pick up whatever the workers finished since the last wakeup
+    void collectResponses() {
+        uint64_t count;
+        ssize_t ignored = read(wakeFd, &count, sizeof(count));
+        (void)ignored;
 
-public:
-    // Add new patient record
-    void addRecord(int patientId, const string& name, int age) {
-        lockMonitor.recordLock = true;
-        unique_lock lock(recordMutex);
-        if (records.find(patientId) == records.end()) {
-            records[patientId] = {patientId, name, age, {}};
-            cout << "Record created for Patient ID " << patientId << ".\n";
-        } else {
-            cout << "Record already exists for this patient.\n";
+        vector<shared_ptr<Connection>> batch;
+        {
+            lock_guard<mutex> lock(readyMutex);
+            batch.swap(ready);
         }
-        lockMonitor.recordLock = false;
-    }
-
-    // Update EXISTING record
-    void updateRecord(int patientId, const string& entry) {
-        if (recordMutex.try_lock()) {
-            if (records.find(patientId) != records.end()) {
-                records[patientId].entries.push_back(entry);
-                cout << "Medical record updated for Patient ID " << patientId << ".\n";
-            } else {
-                cout << "No record found. Add one first.\n";
+        for (auto& c : batch) {
+            if (c->closed) continue;
+            vector<string> done;
+            {
+                lock_guard<mutex> lock(c->lock);
+                done.swap(c->responses);
             }
-            recordMutex.unlock();
-        } else {
-            cout << "Record system is busy. Try again later.\n";
+            for (auto& d : done) {
+                c->outBytes += d.size();
+                c->out.push_back(move(d));
+            }
+            if (c->outBytes > MAX_PENDING_OUTPUT) closeConnection(*c);
+            else if (!c->writing) sendPending(*c);
         }
     }
 
-    // View EXISTING patient record by ID
-    void viewRecord(int patientId) {
-        lockMonitor.recordLock = true;
-        unique_lock lock(recordMutex);
-        if (records.find(patientId) != records.end()) {
-            const auto& r = records[patientId];
-            cout << "Record for Patient ID " << patientId << ":\n";
-            cout << "Name: " << r.patientName << ", Age: " << r.patientAge << "\n";
-            cout << "Entries:\n";
-            for (const auto& entry : r.entries) {
-                cout << "- " << entry << "\n";
+    // Write as much queued output as the socket takes, IOV_MAX frames per call
+    void sendPending(Connection& c) {
+        while (!c.out.empty()) {
+            iovec iov[IOV_MAX];
+            int count = 0;
+            for (auto it = c.out.begin(); it != c.out.end() && count < IOV_MAX; ++it, ++count) {
+                size_t skip = count == 0 ? c.outOffset : 0;
+                iov[count].iov_base = const_cast<char*>(it->data()) + skip;
+                iov[count].iov_len = it->size() - skip;
+            }
+            ssize_t n = writev(c.fd, iov, count);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                closeConnection(c);
+                return;
+            }
+            ++writevCalls;
+            size_t written = size_t(n);
+            c.outBytes -= written;
+            while (written > 0) {
+                size_t rest = c.out.front().size() - c.outOffset;
+                if (written < rest) {
+                    c.outOffset += written;
+                    break;
+                }
+                written -= rest;
+                c.out.pop_front();
+                c.outOffset = 0;
+                ++responsesSent;
             }
-        } else {
-            cout << "No records found for this patient.\n";
         }
-        lockMonitor.recordLock = false;
+        bool wantWrite = !c.out.empty();
+        if (wantWrite != c.writing) {
+            c.writing = wantWrite;
+            watch(c.fd, EPOLLIN | EPOLLRDHUP | (wantWrite ? uint32_t(EPOLLOUT) : 0u), EPOLL_CTL_MOD);
+        }
+    }
+
+    // A worker may still hold the connection; it only ever touches the
+    // locked fields, and collectResponses skips closed connections
+    void closeConnection(Connection& c) {
+        if (c.closed) return;
+        c.closed = true;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        connections.erase(c.fd);
+        connectionCount.set(connections.size());
     }
+
+    PatientManager& pm;
+    AppointmentManager& am;
+    RecordManager& rm;
+    TriageQueue& triage;
+    Analytics analytics;
+    WorkerPool pool;
+
+    int epollFd = -1;
+    int wakeFd = -1;
+    map<int, shared_ptr<Connection>> connections;   // epoll thread only
+    mutex readyMutex;
+    vector<shared_ptr<Connection>> ready;   // connections with new responses
+    atomic<int> busyConnections{0};
+    atomic<uint64_t> requests{0};
+    metrics::Gauge& connectionCount = metrics::gauge("server_connections", "Open client connections");
+    metrics::Gauge& queuedRequests = metrics::gauge("server_queued_requests", "Requests read but not yet executed");
+    uint64_t accepted = 0;
+    uint64_t writevCalls = 0;
+    uint64_t responsesSent = 0;
 };
+
 // =============================================
 
 // =============================================
@@ -244,6 +2991,7 @@ void patientMenu() {
     cout << "2. Update Patient\n";
     cout << "3. Remove Patient\n";
     cout << "4. List Patients\n";
+    cout << "5. View Patient\n";
     cout << "0. Back to Main Menu\n";
     cout << "Choose an option: ";
 }
@@ -255,6 +3003,11 @@ void appointmentMenu() {
     cout << "2. Update Existing Appointment\n";
     cout << "3. Remove Existing Appointment\n";
     cout << "4. List Appointments\n";
+    cout << "5. Find Next Free Slot\n";
+    cout << "6. Find Earliest Slot Across Clinicians\n";
+    cout << "7. View Notifications\n";
+    cout << "8. Set Reminder Offsets\n";
+    cout << "9. Join Waitlist\n";
     cout << "0. Back to Main Menu\n";
     cout << "Choose an option: ";
 }
@@ -269,6 +3022,40 @@ void recordMenu() {
     cout << "Choose an option: ";
 }
 
+// TRIAGE MENU
+void triageMenu() {
+    cout << "\n--- Walk-in Triage Menu ---\n";
+    cout << "1. Admit Walk-in\n";
+    cout << "2. Call Next Patient\n";
+    cout << "3. Queue Report\n";
+    cout << "4. Simulate ER Peak\n";
+    cout << "0. Back to main menu.\n";
+    cout << "Choose an option: ";
+}
+
+// CHANGE STREAM MENU
+void changeStreamMenu() {
+    cout << "\n--- Change Stream Menu ---\n";
+    cout << "1. Stream Status\n";
+    cout << "2. Read New Events\n";
+    cout << "3. Add Background Subscriber\n";
+    cout << "0. Back to main menu.\n";
+    cout << "Choose an option: ";
+}
+
+// FOLLOWER MENU
+void followerMenu() {
+    cout << "\n--- Follower Menu (read-only) ---\n";
+    cout << "1. List Patients\n";
+    cout << "2. View Record\n";
+    cout << "3. List Appointments\n";
+    cout << "4. Find Next Free Slot\n";
+    cout << "5. Replication Status\n";
+    cout << "6. Analytics Report\n";
+    cout << "0. Exit\n";
+    cout << "Choose an option: ";
+}
+
 // MAIN MENU
 void menu() {
     cout << "\n--- Hospital Management Menu ---\n";
@@ -277,16 +3064,417 @@ void menu() {
     cout << "3. Record Management\n";
     cout << "4. Concurrency Control\n";
     cout << "5. Check Deadlocks\n";
+    cout << "6. Walk-in Triage\n";
+    cout << "7. Change Stream\n";
+    cout << "8. Analytics Report\n";
     cout << "0. Exit\n";
     cout << "Choose an option: ";
 }
 // =============================================
 
-int main() {
+// =============================================
+//              CONCURRENT WORKLOADS
+
+// Each workload times its calls into stats when one is given
+
+// Thread 1 - Register Multiple Patients
+void patientWorkload(PatientManager& pm, sim::OpStats* stats) {
+    for (int i = 0; i < 5; ++i) {
+        uint64_t t0 = sim::nowNs();
+        pm.registerPatient("Patient_" + to_string(i), 20 + i);
+        if (stats) stats->record("registerPatient", sim::nowNs() - t0);
+        sim::sleepFor(chrono::milliseconds(100));
+    }
+}
+
+// Thread 2 - Schedule Appointments
+void appointmentWorkload(AppointmentManager& am, sim::OpStats* stats) {
+    for (int i = 1; i <= 5; ++i) {
+        uint64_t t0 = sim::nowNs();
+        am.scheduleAppointment(i, 1, "2025-06-" + to_string(10 + i) + " 09:00", 30, "Checkup");
+        if (stats) stats->record("scheduleAppt", sim::nowNs() - t0);
+        sim::sleepFor(chrono::milliseconds(80));
+    }
+}
+
+// Thread 3 - Add Record Entries
+void recordWorkload(RecordManager& rm, sim::OpStats* stats) {
+    for (int i = 1; i <= 5; ++i) {
+        uint64_t t0 = sim::nowNs();
+        rm.addRecord(i, "Patient_" + to_string(i), 20 + i);
+        if (stats) stats->record("addRecord", sim::nowNs() - t0);
+        t0 = sim::nowNs();
+        rm.updateRecord(i, "Initial visit - all clear");
+        if (stats) stats->record("updateRecord", sim::nowNs() - t0);
+        sim::sleepFor(chrono::milliseconds(90));
+    }
+}
+
+// Simulation only - a front desk editing and browsing while the others run,
+// which is what exposes the try_lock "busy" paths
+void frontDeskWorkload(PatientManager& pm, AppointmentManager& am, RecordManager& rm, sim::OpStats* stats) {
+    for (int i = 1; i <= 5; ++i) {
+        uint64_t t0 = sim::nowNs();
+        pm.updatePatient(i, "Patient_" + to_string(i - 1), 30 + i);
+        if (stats) stats->record("updatePatient", sim::nowNs() - t0);
+        t0 = sim::nowNs();
+        am.updateAppointment(i, "2025-07-" + to_string(10 + i) + " 10:30", "Follow-up");
+        if (stats) stats->record("updateAppt", sim::nowNs() - t0);
+        t0 = sim::nowNs();
+        rm.updateRecord(i, "Front desk note");
+        if (stats) stats->record("updateRecord", sim::nowNs() - t0);
+        t0 = sim::nowNs();
+        am.listAppointments();
+        if (stats) stats->record("listAppts", sim::nowNs() - t0);
+        sim::sleepFor(chrono::milliseconds(70));
+    }
+}
+
+// Count lines of captured output containing text
+int countLines(const string& out, const string& text) {
+    int n = 0;
+    for (size_t pos = out.find(text); pos != string::npos; pos = out.find(text, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+// Run the workloads under the deterministic scheduler for `schedules`
+// consecutive seeds. Output of each run is captured; "busy" answers from the
+// try_lock paths and deadlocks are reported with the seed that replays them.
+int runSimulation(int schedules, uint64_t firstSeed, bool trace) {
+    sim::OpStats stats;
+    vector<uint64_t> makespans;
+    vector<uint64_t> busySeeds, failedSeeds;
+    uint64_t worstSeed = firstSeed, worstTime = 0;
+
+    for (int k = 0; k < schedules; ++k) {
+        uint64_t seed = firstSeed + k;
+        PatientManager pm;
+        AppointmentManager am;
+        RecordManager rm;
+        sim::Scheduler sched(seed, trace);
+
+        sched.spawn("patients", [&]() { patientWorkload(pm, &stats); });
+        sched.spawn("appointments", [&]() { appointmentWorkload(am, &stats); });
+        sched.spawn("records", [&]() { recordWorkload(rm, &stats); });
+        sched.spawn("frontdesk", [&]() { frontDeskWorkload(pm, am, rm, &stats); });
+
+        ostringstream captured;
+        streambuf* saved = cout.rdbuf(captured.rdbuf());
+        bool ok = sched.run();
+        cout.rdbuf(saved);
+
+        string out = captured.str();
+        int busy = countLines(out, "busy") + countLines(out, "Try again later");
+        makespans.push_back(sched.now());
+        if (sched.now() > worstTime) {
+            worstTime = sched.now();
+            worstSeed = seed;
+        }
+        if (!ok) failedSeeds.push_back(seed);
+        if (busy > 0) busySeeds.push_back(seed);
+
+        if (schedules == 1) {
+            cout << out;
+            if (trace) {
+                cout << "\n--- Schedule trace (seed " << seed << ") ---\n";
+                for (const auto& line : sched.trace()) cout << line << "\n";
+            }
+        }
+        if (!ok) {
+            cout << "Seed " << seed << ": " << sched.failure() << "\n";
+        }
+    }
+
+    sort(makespans.begin(), makespans.end());
+    cout << "\n--- Simulation: " << schedules << " schedule(s) from seed " << firstSeed << " ---\n";
+    cout << "Virtual makespan (ms): min " << makespans.front() / 1e6
+         << ", median " << makespans[makespans.size() / 2] / 1e6
+         << ", max " << makespans.back() / 1e6 << " (seed " << worstSeed << ")\n";
+    cout << "Schedules with 'busy' answers: " << busySeeds.size();
+    if (!busySeeds.empty()) cout << " (first seed " << busySeeds.front() << ")";
+    cout << "\nFailed schedules: " << failedSeeds.size();
+    if (!failedSeeds.empty()) cout << " (first seed " << failedSeeds.front() << ")";
+    cout << "\n\nVirtual latency per operation:\n";
+    stats.print(cout);
+    cout << "Replay one schedule with: --simulate 1 --sim-seed <seed> --sim-trace\n";
+    return failedSeeds.empty() ? 0 : 1;
+}
+
+// One load-driving connection: keeps up to `depth` requests in flight and
+// records each response's latency under its operation name
+void loadConnection(int port, int client, int requests, int depth, sim::OpStats& stats, atomic<int>& errors) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(uint16_t(port));
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        errors.fetch_add(requests);
+        if (fd >= 0) close(fd);
+        return;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    uint64_t rng = 0x9e3779b97f4a7c15ull * (client + 1);
+    auto next = [&]() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    };
+    auto datetime = [&]() {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "2030-01-%02d %02d:%02d", int(1 + next() % 28), int(8 + next() % 9),
+                 int(next() % 4) * 15);
+        return string(buf);
+    };
+
+    vector<const char*> names(requests);
+    vector<chrono::steady_clock::time_point> sentAt(requests);
+    int sent = 0, received = 0;
+    string in;
+    char chunk[65536];
+    while (received < requests) {
+        string frames;
+        while (sent < requests && sent - received < depth) {
+            FrameWriter f;
+            f.u32(uint32_t(sent));
+            int patientId = 1 + int(next() % 1000);
+            int kind = int(next() % 100);
+            if (kind < 30) {
+                f.u8(uint8_t(ServerOp::RegisterPatient));
+                f.str("Load_" + to_string(client) + "_" + to_string(sent));
+                f.i32(20 + sent % 60);
+                names[sent] = "registerPatient";
+            } else if (kind < 50) {
+                f.u8(uint8_t(ServerOp::ScheduleAppointment));
+                f.i32(patientId);
+                f.i32(1 + int(next() % 20));
+                f.str(datetime());
+                f.i32(30);
+                f.str("Load test");
+                names[sent] = "scheduleAppt";
+            } else if (kind < 65) {
+                f.u8(uint8_t(ServerOp::FindFreeSlot));
+                f.i32(1 + int(next() % 20));
+                f.str("2030-01-01 08:00");
+                f.i32(30);
+                names[sent] = "findFreeSlot";
+            } else if (kind < 75) {
+                f.u8(uint8_t(ServerOp::AddRecord));
+                f.i32(patientId);
+                f.str("Patient_" + to_string(patientId));
+                f.i32(30);
+                names[sent] = "addRecord";
+            } else if (kind < 85) {
+                f.u8(uint8_t(ServerOp::UpdateRecord));
+                f.i32(patientId);
+                f.str("Load test note");
+                names[sent] = "updateRecord";
+            } else if (kind < 95) {
+                f.u8(uint8_t(ServerOp::ViewRecord));
+                f.i32(patientId);
+                names[sent] = "viewRecord";
+            } else {
+                bool admit = kind % 2 == 0;
+                f.u8(uint8_t(admit ? ServerOp::AdmitWalkIn : ServerOp::CallNextWalkIn));
+                if (admit) {
+                    f.str("Walk-in");
+                    f.i32(1 + int(next() % TriageQueue::LEVELS));
+                }
+                names[sent] = admit ? "admitWalkIn" : "callNextWalkIn";
+            }
+            frames += f.frame();
+            sentAt[sent++] = chrono::steady_clock::now();
+        }
+        if (!frames.empty() && !sendAll(fd, frames)) break;
+
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) break;
+        in.append(chunk, size_t(n));
+        size_t pos = 0;
+        while (in.size() - pos >= 4) {
+            FrameReader header{in.data() + pos, in.size() - pos};
+            uint32_t length = header.u32();
+            if (in.size() - pos - 4 < length) break;
+            uint32_t id = header.u32();
+            uint8_t status = header.u8();
+            if (id < uint32_t(requests)) {
+                stats.record(names[id], uint64_t(chrono::duration_cast<chrono::nanoseconds>(
+                                            chrono::steady_clock::now() - sentAt[id]).count()));
+            }
+            if (status != STATUS_OK) errors.fetch_add(1);
+            ++received;
+            pos += 4 + length;
+        }
+        in.erase(0, pos);
+    }
+    errors.fetch_add(requests - received);
+    close(fd);
+}
+
+// Drive a running --serve instance from many connections
+int runLoadClient(int port, int clients, int requests, int depth) {
+    sim::OpStats stats;
+    atomic<int> errors{0};
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back(loadConnection, port, c, requests, max(1, depth), ref(stats), ref(errors));
+    }
+    for (auto& t : threads) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+    long long total = 1LL * clients * requests;
+    cout << total << " requests over " << clients << " connections (pipeline depth " << depth << ") in "
+         << int(seconds * 1000) << " ms: " << int(total / seconds) << " requests/s, "
+         << errors.load() << " failed\n\n";
+    stats.print(cout);
+    return errors.load() == 0 ? 0 : 1;
+}
+// =============================================
+
+// Read-only process that mirrors a leader (--follower <socket>)
+int runFollower(const string& socketPath) {
+    PatientManager pm;
+    AppointmentManager am;
+    RecordManager rm;
+    ReplicationFollower follower(pm, am, rm);
+    Analytics analytics(pm, am, rm);
+    follower.start(socketPath);
+
+    int choice = -1;
+    while (choice != 0) {
+        followerMenu();
+        if (!(cin >> choice)) break;   // input closed
+
+        if (choice == 1) { // Patients as last replicated
+            pm.listPatient();
+        } else if (choice == 2) { // One patient's record
+            int id;
+            cout << "Enter Patient ID: ";
+            while (!(cin >> id)) {
+                cout << "Invalid ID. Please enter a number: ";
+                cin.clear();
+                cin.ignore(1000, '\n');
+            }
+            rm.viewRecord(id);
+        } else if (choice == 3) { // Appointments as last replicated
+            am.listAppointments();
+        } else if (choice == 4) { // Free slots from the replicated calendar
+            int clinicianId, minutes;
+            string from;
+            cout << "Enter Clinician ID: ";
+            while (!(cin >> clinicianId)) {
+                cout << "Invalid Clinician ID. Please enter a number: ";
+                cin.clear();
+                cin.ignore(1000, '\n');
+            }
+            cin.ignore();
+            cout << "Search From (YYYY-MM-DD HH:MM): ";
+            getline(cin, from);
+            cout << "Enter Duration (minutes): ";
+            while (!(cin >> minutes)) {
+                cout << "Invalid duration. Please enter a number: ";
+                cin.clear();
+                cin.ignore(1000, '\n');
+            }
+            am.findFreeSlot(clinicianId, from, minutes);
+        } else if (choice == 5) { // Lag behind the leader
+            follower.report();
+        } else if (choice == 6) { // Reports run on the replica, off the leader
+            analytics.report();
+        } else if (choice == 0) {
+            cout << "Terminating follower...\n";
+        } else {
+            cout << "Invalid choice.\n";
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Deterministic simulation: --simulate <schedules> [--sim-seed <seed>] [--sim-trace]
+    // Replication: --leader <socket> serves followers, --follower <socket> mirrors a leader
+    // Network: --serve <port> [--workers <n>] runs headless; --load <port> [--clients <n>]
+    //          [--requests <n>] [--depth <n>] drives a running server
+    // Tracing: --trace <file> names the Chrome trace (builds with -DENABLE_TRACING)
+    // Metrics: --metrics-file <file> and/or --metrics-port <port> export Prometheus
+    //          text, the file rewritten every --metrics-interval <seconds> (default 5)
+    int schedules = 0;
+    uint64_t seed = 1;
+    bool trace = false;
+    string leaderPath, followerPath, tracePath = "hospital.trace.json", metricsPath;
+    bool traceRequested = false;
+    int servePort = 0, loadPort = 0, metricsPort = 0, metricsInterval = 5;
+    int workers = int(max(2u, thread::hardware_concurrency()));
+    int clients = 16, requests = 10000, depth = 16;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--simulate" && i + 1 < argc) schedules = atoi(argv[++i]);
+        else if (arg == "--sim-seed" && i + 1 < argc) seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--sim-trace") trace = true;
+        else if (arg == "--leader" && i + 1 < argc) leaderPath = argv[++i];
+        else if (arg == "--follower" && i + 1 < argc) followerPath = argv[++i];
+        else if (arg == "--serve" && i + 1 < argc) servePort = atoi(argv[++i]);
+        else if (arg == "--workers" && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (arg == "--load" && i + 1 < argc) loadPort = atoi(argv[++i]);
+        else if (arg == "--clients" && i + 1 < argc) clients = atoi(argv[++i]);
+        else if (arg == "--requests" && i + 1 < argc) requests = atoi(argv[++i]);
+        else if (arg == "--depth" && i + 1 < argc) depth = atoi(argv[++i]);
+        else if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i], traceRequested = true;
+        else if (arg == "--metrics-file" && i + 1 < argc) metricsPath = argv[++i];
+        else if (arg == "--metrics-port" && i + 1 < argc) metricsPort = atoi(argv[++i]);
+        else if (arg == "--metrics-interval" && i + 1 < argc) metricsInterval = atoi(argv[++i]);
+    }
+    if (traceRequested && !trace::enabled) {
+        cout << "Tracing is not compiled in; rebuild with -DENABLE_TRACING.\n";
+    }
+    trace::Session tracing(traceRequested ? tracePath : "");
+    TRACE_THREAD_NAME("main");
+    metrics::Registry::get().setNamespace("hospital");
+    metrics::Exporter exporter(metricsPath, metricsPort, chrono::seconds(max(1, metricsInterval)));
+    if (!exporter.start()) {
+        cout << "Could not serve metrics on port " << metricsPort << ".\n";
+    } else if (metricsPort > 0) {
+        cout << "Metrics at http://127.0.0.1:" << metricsPort << "/metrics\n";
+    }
+    if (schedules > 0) {
+        return runSimulation(schedules, seed, trace);
+    }
+    if (!followerPath.empty()) {
+        return runFollower(followerPath);
+    }
+    if (loadPort > 0) {
+        return runLoadClient(loadPort, clients, requests, depth);
+    }
+
     // Create instances of the three system managers
     PatientManager pm;
     AppointmentManager am;
     RecordManager rm;
+    TriageQueue triage;
+    Analytics analytics(pm, am, rm);
+    am.startDispatcher();
+
+    ReplicationLeader leader(pm, am, rm);
+    if (!leaderPath.empty()) {
+        if (leader.start(leaderPath)) cout << "Serving followers on " << leaderPath << "\n";
+        else cout << "Could not listen on " << leaderPath << "; running without followers.\n";
+    }
+    if (servePort > 0) {
+        HospitalServer server(pm, am, rm, triage, unsigned(max(1, workers)));
+        return server.run(servePort);
+    }
+
+    // The console reads the stream on demand; background subscribers
+    // consume it at their own pace until the program ends
+    auto console = changeStream.subscribe("console");
+    vector<thread> subscriberThreads;
+    atomic<bool> stopSubscribers{false};
     int mainChoice = -1; // Set to run at least once
 
     while (mainChoice != 0) {
@@ -352,6 +3540,18 @@ int main() {
                     pm.removePatient(id);
                 } else if (patientChoice == 4) { // List ALL EXISTING patients
                     pm.listPatient();
+                } else if (patientChoice == 5) { // View one patient
+                    while (true) {
+                        cout << "Enter ID: ";
+                        if (cin >> id) {
+                            break;
+                        } else {
+                            cout << "Invalid. Please enter a valid ID.\n";
+                            cin.clear();
+                            cin.ignore(1000, '\n');
+                        }
+                    }
+                    pm.viewPatient(id);
                 } else if (patientChoice == 0) {
                     cout << "Returning to main menu...\n";
                 } else {
@@ -365,7 +3565,7 @@ int main() {
                 cin >> appointmentChoice;
 
                 if (appointmentChoice == 1) { // Schedule new appointment
-                    int patientId;
+                    int patientId, clinicianId, minutes;
                     string date, reason;
 
                     cout << "Enter Patient ID: ";
@@ -374,15 +3574,30 @@ int main() {
                         cin.clear();
                         cin.ignore(1000, '\n');
                     }
+
+                    cout << "Enter Clinician ID: ";
+                    while (!(cin >> clinicianId)) {
+                        cout << "Invalid Clinician ID. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
                     cin.ignore(); // Clear newline after integer input
 
-                    cout << "Enter Appointment Date: ";
+                    cout << "Enter Appointment Date (YYYY-MM-DD HH:MM): ";
                     getline(cin, date);
 
+                    cout << "Enter Duration (minutes): ";
+                    while (!(cin >> minutes)) {
+                        cout << "Invalid duration. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+                    cin.ignore();
+
                     cout << "Enter Reason: ";
                     getline(cin, reason);
 
-                    am.scheduleAppointment(patientId, date, reason);
+                    am.scheduleAppointment(patientId, clinicianId, date, minutes, reason);
 
                 } else if (appointmentChoice == 2) { // Update EXISTING appointment
                     int id;
@@ -396,7 +3611,7 @@ int main() {
                     }
                     cin.ignore();
 
-                    cout << "Enter New Date: ";
+                    cout << "Enter New Date (YYYY-MM-DD HH:MM): ";
                     getline(cin, newDate);
 
                     cout << "Enter New Reason: ";
@@ -419,6 +3634,113 @@ int main() {
                 } else if (appointmentChoice == 4) { // List ALL EXISTING appointments
                     am.listAppointments();
 
+                } else if (appointmentChoice == 5) { // Earliest free slot for a clinician
+                    int clinicianId, minutes;
+                    string from;
+
+                    cout << "Enter Clinician ID: ";
+                    while (!(cin >> clinicianId)) {
+                        cout << "Invalid Clinician ID. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+                    cin.ignore();
+
+                    cout << "Search From (YYYY-MM-DD HH:MM): ";
+                    getline(cin, from);
+
+                    cout << "Enter Duration (minutes): ";
+                    while (!(cin >> minutes)) {
+                        cout << "Invalid duration. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+
+                    am.findFreeSlot(clinicianId, from, minutes);
+
+                } else if (appointmentChoice == 6) { // Earliest slot over many clinicians
+                    string ids, from, to, dailyFrom, dailyTo;
+                    int minutes;
+
+                    cin.ignore();
+                    cout << "Clinician IDs (comma-separated, blank = all): ";
+                    getline(cin, ids);
+                    cout << "Earliest (YYYY-MM-DD HH:MM): ";
+                    getline(cin, from);
+                    cout << "Latest (YYYY-MM-DD HH:MM): ";
+                    getline(cin, to);
+                    cout << "Daily hours from (HH:MM): ";
+                    getline(cin, dailyFrom);
+                    cout << "Daily hours to (HH:MM): ";
+                    getline(cin, dailyTo);
+
+                    cout << "Enter Duration (minutes): ";
+                    while (!(cin >> minutes)) {
+                        cout << "Invalid duration. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+
+                    vector<int> clinicians;
+                    stringstream list(ids);
+                    string item;
+                    while (getline(list, item, ',')) {
+                        if (item.find_first_not_of(" ") != string::npos) clinicians.push_back(atoi(item.c_str()));
+                    }
+                    am.findEarliestAcross(clinicians, from, to, dailyFrom, dailyTo, minutes);
+
+                } else if (appointmentChoice == 7) { // Reminders and waitlist bookings from the dispatcher
+                    am.showReminders();
+
+                } else if (appointmentChoice == 8) { // Minutes-before offsets for new reminders
+                    string line;
+                    cin.ignore();
+                    cout << "Minutes before appointment (comma-separated, e.g. 1440,60): ";
+                    getline(cin, line);
+
+                    vector<int> offsets;
+                    stringstream list(line);
+                    string item;
+                    while (getline(list, item, ',')) {
+                        int minutes = atoi(item.c_str());
+                        if (minutes > 0) offsets.push_back(minutes);
+                    }
+                    am.setReminderOffsets(offsets);
+
+                } else if (appointmentChoice == 9) { // Wait for a cancellation on a fully booked day
+                    int patientId, clinicianId, minutes;
+                    string date, reason;
+
+                    cout << "Enter Patient ID: ";
+                    while (!(cin >> patientId)) {
+                        cout << "Invalid Patient ID. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+                    cout << "Enter Clinician ID: ";
+                    while (!(cin >> clinicianId)) {
+                        cout << "Invalid Clinician ID. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+                    cin.ignore();
+
+                    cout << "Enter Date (YYYY-MM-DD): ";
+                    getline(cin, date);
+
+                    cout << "Enter Duration (minutes): ";
+                    while (!(cin >> minutes)) {
+                        cout << "Invalid duration. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+                    cin.ignore();
+
+                    cout << "Enter Reason: ";
+                    getline(cin, reason);
+
+                    am.joinWaitlist(patientId, clinicianId, date, minutes, reason);
+
                 } else if (appointmentChoice == 0) {
                     cout << "Returning to main menu...\n";
                 } else {
@@ -468,6 +3790,124 @@ int main() {
             lockMonitor.displayLockStatus();
         } else if (mainChoice == 5) { // Check for deadlocks
             lockMonitor.checkDeadlocks();
+        } else if (mainChoice == 6) { // Walk-in triage
+            int triageChoice = -1;
+            while (triageChoice != 0) {
+                triageMenu();
+                cin >> triageChoice;
+                cin.ignore();
+
+                if (triageChoice == 1) { // Admit a walk-in with a severity
+                    string name;
+                    int severity;
+                    cout << "Enter Name: ";
+                    getline(cin, name);
+                    cout << "Enter Severity (1 = most urgent ... 5): ";
+                    while (!(cin >> severity) || severity < 1 || severity > TriageQueue::LEVELS) {
+                        cout << "Invalid severity. Please enter 1-5: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+                    int ticket = triage.admit(name, severity);
+                    cout << "Walk-in admitted with ticket " << ticket << ".\n";
+                } else if (triageChoice == 2) { // Next patient for a clinician
+                    WalkIn next;
+                    if (triage.callNext(next)) {
+                        cout << "Next: ticket " << next.id << ", " << next.name
+                             << " (severity " << next.severity << ")\n";
+                    } else {
+                        cout << "No walk-ins waiting.\n";
+                    }
+                } else if (triageChoice == 3) { // Depth and waits by severity
+                    triage.report();
+                } else if (triageChoice == 4) { // Burst of arrivals against many clinicians
+                    int arrivals, clinicians;
+                    cout << "Arrivals: ";
+                    cin >> arrivals;
+                    cout << "Clinician threads: ";
+                    cin >> clinicians;
+
+                    atomic<int> admitted{0}, seen{0};
+                    vector<thread> threads;
+                    for (int f = 0; f < 4; ++f) {
+                        threads.emplace_back([&, f]() {
+                            for (int i = f; i < arrivals; i += 4) {
+                                triage.admit("Walk-in " + to_string(i), 1 + (i * 7 + f) % TriageQueue::LEVELS);
+                                admitted.fetch_add(1);
+                            }
+                        });
+                    }
+                    for (int c = 0; c < clinicians; ++c) {
+                        threads.emplace_back([&]() {
+                            WalkIn w;
+                            while (seen.load() < arrivals) {
+                                if (triage.callNext(w)) seen.fetch_add(1);
+                                else this_thread::yield();
+                            }
+                        });
+                    }
+                    auto t0 = chrono::steady_clock::now();
+                    for (auto& t : threads) t.join();
+                    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - t0).count();
+                    cout << admitted.load() << " walk-ins triaged by " << clinicians
+                         << " clinician threads in " << ms << " ms.\n";
+                    triage.report();
+                } else if (triageChoice == 0) {
+                    cout << "Returning to main menu...\n";
+                } else {
+                    cout << "Invalid choice.\n";
+                }
+            }
+        } else if (mainChoice == 7) { // Change data capture
+            int streamChoice = -1;
+            while (streamChoice != 0) {
+                changeStreamMenu();
+                cin >> streamChoice;
+                cin.ignore();
+
+                if (streamChoice == 1) { // Published count and lag per subscriber
+                    changeStream.report();
+                } else if (streamChoice == 2) { // Everything since the last read
+                    vector<ChangeEvent> events;
+                    size_t dropped = console->dropped.load();
+                    changeStream.poll(*console, events);
+                    if (console->dropped.load() != dropped) {
+                        cout << "(" << console->dropped.load() - dropped << " older events were overwritten)\n";
+                    }
+                    if (events.empty()) cout << "No new events.\n";
+                    for (const auto& e : events) cout << ChangeStream::describe(e) << "\n";
+                } else if (streamChoice == 3) { // A consumer with a fixed cost per event
+                    string name;
+                    int delayMs;
+                    cout << "Subscriber name: ";
+                    getline(cin, name);
+                    cout << "Processing time per event (ms): ";
+                    while (!(cin >> delayMs) || delayMs < 0) {
+                        cout << "Invalid delay. Please enter a number: ";
+                        cin.clear();
+                        cin.ignore(1000, '\n');
+                    }
+                    auto sub = changeStream.subscribe(name, true);
+                    subscriberThreads.emplace_back([sub, delayMs, &stopSubscribers]() {
+                        vector<ChangeEvent> events;
+                        while (!stopSubscribers.load()) {
+                            events.clear();
+                            if (changeStream.poll(*sub, events, 1) == 0) {
+                                this_thread::sleep_for(chrono::milliseconds(10));
+                                continue;
+                            }
+                            this_thread::sleep_for(chrono::milliseconds(delayMs));
+                        }
+                    });
+                    cout << "Subscriber " << name << " started from the oldest retained event.\n";
+                } else if (streamChoice == 0) {
+                    cout << "Returning to main menu...\n";
+                } else {
+                    cout << "Invalid choice.\n";
+                }
+            }
+        } else if (mainChoice == 8) { // Volume, reasons, ages and record growth
+            analytics.report();
         } else if (mainChoice == 0) { // Exit
             cout << "Terminating program...\n";
         } else {
@@ -477,40 +3917,19 @@ int main() {
     // Simulate concurrency with threads
     cout << "\n--- Simulating concurrent operations ---\n";
 
-    // Thread 1 - Register Multiple Patients
-    auto patientThread = [&]() {
-        for (int i = 0; i < 5; ++i) {
-            pm.registerPatient("Patient_" + to_string(i), 20 + i);
-            this_thread::sleep_for(chrono::milliseconds(100));
-        }
-    };
-
-    // Thread 2 - Schedule Appointments
-    auto appointmentThread = [&]() {
-        for (int i = 1; i <= 5; ++i) {
-            am.scheduleAppointment(i, "2025-06-" + to_string(10 + i), "Checkup");
-            this_thread::sleep_for(chrono::milliseconds(80));
-        }
-    };
-
-    // Thread 3 - Add Record Entries
-    auto recordThread = [&]() {
-        for (int i = 1; i <= 5; ++i) {
-            rm.addRecord(i, "Patient_" + to_string(i), 20 + i);
-            rm.updateRecord(i, "Initial visit - all clear");
-            this_thread::sleep_for(chrono::milliseconds(90));
-        }
-    };
-
-    thread t1(patientThread);
-    thread t2(appointmentThread);
-    thread t3(recordThread);
+    thread t1(patientWorkload, ref(pm), nullptr);
+    thread t2(appointmentWorkload, ref(am), nullptr);
+    thread t3(recordWorkload, ref(rm), nullptr);
 
     t1.join();
     t2.join();
     t3.join();
 
     cout << "\n--- Concurrent operations finished ---\n";
+
+    stopSubscribers = true;
+    for (auto& t : subscriberThreads) t.join();
+    changeStream.report();
                                      // The program will always do the ff:
     lockMonitor.displayLockStatus(); // Display lock status and check for deadlocks at the end of the program
     lockMonitor.checkDeadlocks();
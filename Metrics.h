@@ -0,0 +1,731 @@
+// Process-wide metrics registry shared by both programs, exported in the
+// Prometheus text format (version 0.0.4).
+//
+//   metrics::Counter &c = metrics::counter("name_total", "help", {{"label", "v"}});
+//   metrics::Gauge &g = metrics::gauge("name", "help");
+//   metrics::Histogram &h = metrics::histogram("name_seconds", "help", metrics::latencyBuckets());
+//
+// Lookups take the registry mutex and return a reference that stays valid
+// for the life of the process, so callers resolve a metric once and keep
+// it. Updates never lock: counters and histograms are striped over
+// cache-line cells and each thread bumps its own cell with a relaxed add;
+// readers sum the cells. Gauges are a single atomic.
+//
+// Two helpers cover the common cases:
+//   metrics::Operation  ops counted by result (ok, error, busy) and timed
+//   metrics::Metered<M> a lock reporting its waits and failed try_locks
+//
+// metrics::Exporter writes the registry to a file and/or serves it on
+// http://127.0.0.1:<port>/metrics, refreshing the file every interval.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace metrics
+{
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Stable per-thread cell index; threads are spread round-robin
+inline unsigned stripe()
+{
+    static std::atomic<unsigned> next{0};
+    thread_local unsigned mine = next.fetch_add(1, std::memory_order_relaxed);
+    return mine;
+}
+
+// Upper bounds in seconds, 1 us to 5 s
+inline const std::vector<double> &latencyBuckets()
+{
+    static const std::vector<double> bounds{1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3,
+                                            5e-3, 1e-2, 5e-2, 0.1,  0.5,  1.0,  5.0};
+    return bounds;
+}
+
+inline std::string formatValue(double v)
+{
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.9g", v);
+    return buf;
+}
+
+class Metric
+{
+public:
+    explicit Metric(Labels labels) : labels(std::move(labels)) {}
+    virtual ~Metric() = default;
+
+    // Sample lines for this child; `labels` is already rendered
+    virtual void write(std::ostream &out, const std::string &name, const std::string &labels) const = 0;
+
+    std::string label(const std::string &key) const
+    {
+        for (auto &[k, v] : labels)
+            if (k == key)
+                return v;
+        return "";
+    }
+
+    const Labels labels;
+};
+
+class Counter : public Metric
+{
+public:
+    static constexpr unsigned STRIPES = 16;
+
+    using Metric::Metric;
+
+    void inc(uint64_t n = 1)
+    {
+        cells[stripe() % STRIPES].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const
+    {
+        uint64_t sum = 0;
+        for (auto &c : cells)
+            sum += c.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    void write(std::ostream &out, const std::string &name, const std::string &labels) const override
+    {
+        out << name << labels << " " << value() << "\n";
+    }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<uint64_t> value{0};
+    };
+    Cell cells[STRIPES];
+};
+
+class Gauge : public Metric
+{
+public:
+    using Metric::Metric;
+
+    void set(int64_t v) { current.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { current.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return current.load(std::memory_order_relaxed); }
+
+    void write(std::ostream &out, const std::string &name, const std::string &labels) const override
+    {
+        out << name << labels << " " << value() << "\n";
+    }
+
+private:
+    std::atomic<int64_t> current{0};
+};
+
+class Histogram : public Metric
+{
+public:
+    static constexpr unsigned STRIPES = 8;
+
+    Histogram(Labels labels, std::vector<double> bounds)
+        : Metric(std::move(labels)), bounds(std::move(bounds))
+    {
+        for (auto &c : cells)
+        {
+            c.buckets = std::make_unique<std::atomic<uint64_t>[]>(this->bounds.size() + 1);
+            for (size_t i = 0; i <= this->bounds.size(); ++i)
+                c.buckets[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void observe(double v)
+    {
+        Cell  &c = cells[stripe() % STRIPES];
+        size_t i = std::lower_bound(bounds.begin(), bounds.end(), v) - bounds.begin();
+        c.buckets[i].fetch_add(1, std::memory_order_relaxed);
+        double sum = c.sum.load(std::memory_order_relaxed);
+        while (!c.sum.compare_exchange_weak(sum, sum + v, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void observeNs(uint64_t ns) { observe(ns / 1e9); }
+
+    // Per-bucket counts, the last one being +Inf
+    std::vector<uint64_t> counts() const
+    {
+        std::vector<uint64_t> out(bounds.size() + 1, 0);
+        for (auto &c : cells)
+            for (size_t i = 0; i < out.size(); ++i)
+                out[i] += c.buckets[i].load(std::memory_order_relaxed);
+        return out;
+    }
+
+    uint64_t count() const
+    {
+        uint64_t n = 0;
+        for (uint64_t b : counts())
+            n += b;
+        return n;
+    }
+
+    double sum() const
+    {
+        double s = 0;
+        for (auto &c : cells)
+            s += c.sum.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    // Upper bound of the bucket holding quantile q; 0 when empty
+    double quantile(double q) const
+    {
+        std::vector<uint64_t> b = counts();
+        uint64_t total = 0;
+        for (uint64_t n : b)
+            total += n;
+        if (total == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * total + 0.5)), seen = 0;
+        for (size_t i = 0; i < bounds.size(); ++i)
+            if ((seen += b[i]) >= rank)
+                return bounds[i];
+        return bounds.empty() ? 0 : bounds.back();   // beyond the last bound
+    }
+
+    void write(std::ostream &out, const std::string &name, const std::string &labels) const override
+    {
+        // labels is `{a="x"}` or empty; le joins it as one more label
+        std::string open = labels.empty() ? "{" : labels.substr(0, labels.size() - 1) + ",";
+        std::vector<uint64_t> b = counts();
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < bounds.size(); ++i)
+        {
+            cumulative += b[i];
+            out << name << "_bucket" << open << "le=\"" << formatValue(bounds[i]) << "\"} " << cumulative << "\n";
+        }
+        cumulative += b.back();
+        out << name << "_bucket" << open << "le=\"+Inf\"} " << cumulative << "\n";
+        out << name << "_sum" << labels << " " << formatValue(sum()) << "\n";
+        out << name << "_count" << labels << " " << cumulative << "\n";
+    }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+        std::atomic<double>                      sum{0};
+    };
+
+    const std::vector<double> bounds;
+    Cell                      cells[STRIPES];
+};
+
+class Registry
+{
+public:
+    static Registry &get()
+    {
+        static Registry r;
+        return r;
+    }
+
+    // Prefix added to every name on export, e.g. "hospital"
+    void setNamespace(const std::string &ns)
+    {
+        std::lock_guard<std::mutex> lk(registryMutex);
+        prefix = ns.empty() ? "" : ns + "_";
+    }
+
+    Counter &counter(const std::string &name, const std::string &help, const Labels &labels)
+    {
+        return child<Counter>(name, help, "counter", labels, [&]() { return std::make_unique<Counter>(labels); });
+    }
+
+    Gauge &gauge(const std::string &name, const std::string &help, const Labels &labels)
+    {
+        return child<Gauge>(name, help, "gauge", labels, [&]() { return std::make_unique<Gauge>(labels); });
+    }
+
+    Histogram &histogram(const std::string &name, const std::string &help,
+                         const std::vector<double> &bounds, const Labels &labels)
+    {
+        return child<Histogram>(name, help, "histogram", labels,
+                                [&]() { return std::make_unique<Histogram>(labels, bounds); });
+    }
+
+    // Every child of one family, in label order
+    template <class T>
+    std::vector<const T *> children(const std::string &name)
+    {
+        std::vector<const T *> out;
+        std::lock_guard<std::mutex> lk(registryMutex);
+        auto it = families.find(name);
+        if (it == families.end())
+            return out;
+        for (auto &[key, m] : it->second.children)
+            if (auto *t = dynamic_cast<const T *>(m.get()))
+                out.push_back(t);
+        return out;
+    }
+
+    void write(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lk(registryMutex);
+        for (auto &[name, f] : families)
+        {
+            std::string full = prefix + name;
+            out << "# HELP " << full << " " << f.help << "\n";
+            out << "# TYPE " << full << " " << f.type << "\n";
+            for (auto &[key, m] : f.children)
+                m->write(out, full, key);
+        }
+    }
+
+    std::string text()
+    {
+        std::ostringstream out;
+        write(out);
+        return out.str();
+    }
+
+    // Seconds since the registry was first used
+    double uptime() const { return (now() - started) / 1e9; }
+
+private:
+    struct Family
+    {
+        std::string                                    help;
+        const char                                    *type;
+        std::map<std::string, std::unique_ptr<Metric>> children;   // by rendered labels
+    };
+
+    static std::string render(const Labels &labels)
+    {
+        if (labels.empty())
+            return "";
+        std::string out = "{";
+        for (size_t i = 0; i < labels.size(); ++i)
+        {
+            out += (i ? "," : "") + labels[i].first + "=\"";
+            for (char c : labels[i].second)
+            {
+                if (c == '\n')
+                    out += "\\n";
+                else
+                {
+                    if (c == '"' || c == '\\')
+                        out += '\\';
+                    out += c;
+                }
+            }
+            out += "\"";
+        }
+        return out + "}";
+    }
+
+    template <class T, class Make>
+    T &child(const std::string &name, const std::string &help, const char *type, const Labels &labels, Make make)
+    {
+        std::lock_guard<std::mutex> lk(registryMutex);
+        Family &f = families[name];
+        if (f.type == nullptr)
+        {
+            f.help = help;
+            f.type = type;
+        }
+        else if (std::string(f.type) != type)
+            throw std::logic_error("metric " + name + " registered as " + f.type + " and " + type);
+
+        std::unique_ptr<Metric> &m = f.children[render(labels)];
+        if (!m)
+            m = make();
+        return static_cast<T &>(*m);
+    }
+
+    std::mutex                    registryMutex;
+    std::map<std::string, Family> families;
+    std::string                   prefix;
+    const uint64_t                started = now();
+};
+
+inline Counter &counter(const std::string &name, const std::string &help, const Labels &labels = {})
+{
+    return Registry::get().counter(name, help, labels);
+}
+
+inline Gauge &gauge(const std::string &name, const std::string &help, const Labels &labels = {})
+{
+    return Registry::get().gauge(name, help, labels);
+}
+
+inline Histogram &histogram(const std::string &name, const std::string &help,
+                            const std::vector<double> &bounds, const Labels &labels = {})
+{
+    return Registry::get().histogram(name, help, bounds, labels);
+}
+
+// One kind of operation: operations_total{op,result} and operation_seconds{op}
+class Operation
+{
+public:
+    explicit Operation(const std::string &op)
+        : okCount(counter("operations_total", "Operations by name and result", {{"op", op}, {"result", "ok"}})),
+          errorCount(counter("operations_total", "Operations by name and result", {{"op", op}, {"result", "error"}})),
+          busyCount(counter("operations_total", "Operations by name and result", {{"op", op}, {"result", "busy"}})),
+          seconds(histogram("operation_seconds", "Operation latency", latencyBuckets(), {{"op", op}}))
+    {
+    }
+
+    // Times the enclosing scope; counts as ok unless error() or busy() is called
+    class Scope
+    {
+    public:
+        explicit Scope(Operation &op) : op(op), start(now()) {}
+
+        ~Scope()
+        {
+            op.seconds.observeNs(now() - start);
+            result->inc();
+        }
+
+        void error() { result = &op.errorCount; }
+        void busy() { result = &op.busyCount; }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Operation &op;
+        uint64_t   start;
+        Counter   *result = &op.okCount;
+    };
+
+private:
+    Counter   &okCount;
+    Counter   &errorCount;
+    Counter   &busyCount;
+    Histogram &seconds;
+};
+
+// The families behind Metered, for locks that meter themselves
+inline Histogram &lockWaits(const char *lock, const char *mode)
+{
+    return histogram("lock_wait_seconds", "Time spent waiting to acquire a lock", latencyBuckets(),
+                     {{"lock", lock}, {"mode", mode}});
+}
+
+inline Counter &lockBusy(const char *lock)
+{
+    return counter("lock_busy_total", "try_lock calls that found the lock taken", {{"lock", lock}});
+}
+
+template <class M, class = void>
+struct HasShared : std::false_type
+{
+};
+
+template <class M>
+struct HasShared<M, std::void_t<decltype(std::declval<M &>().lock_shared())>> : std::true_type
+{
+};
+
+// Any lockable, reporting lock_wait_seconds{lock,mode} for every
+// acquisition (a successful try_lock waits 0) and lock_busy_total{lock}
+// for every failed try_lock
+template <class M>
+class Metered
+{
+public:
+    explicit Metered(const char *name)
+        : exclusiveWaits(lockWaits(name, "exclusive")),
+          sharedWaits(HasShared<M>::value ? &lockWaits(name, "shared") : nullptr),
+          busyCount(lockBusy(name))
+    {
+    }
+
+    void lock()
+    {
+        uint64_t t = now();
+        m.lock();
+        exclusiveWaits.observeNs(now() - t);
+    }
+
+    bool try_lock()
+    {
+        if (!m.try_lock())
+        {
+            busyCount.inc();
+            return false;
+        }
+        exclusiveWaits.observe(0);
+        return true;
+    }
+
+    void unlock() { m.unlock(); }
+
+    void lock_shared()
+    {
+        uint64_t t = now();
+        m.lock_shared();
+        sharedWaits->observeNs(now() - t);
+    }
+
+    bool try_lock_shared()
+    {
+        if (!m.try_lock_shared())
+        {
+            busyCount.inc();
+            return false;
+        }
+        sharedWaits->observe(0);
+        return true;
+    }
+
+    void unlock_shared() { m.unlock_shared(); }
+
+private:
+    M          m;
+    Histogram &exclusiveWaits;
+    Histogram *sharedWaits;
+    Counter   &busyCount;
+};
+
+// Console summaries for the lock status menus
+inline void writeLockTable(std::ostream &out)
+{
+    auto waits = Registry::get().children<Histogram>("lock_wait_seconds");
+    auto busy  = Registry::get().children<Counter>("lock_busy_total");
+
+    out << std::left << std::setw(24) << "Lock" << std::setw(11) << "Mode" << std::right
+        << std::setw(12) << "Acquired" << std::setw(10) << "Busy" << std::setw(14) << "Mean wait us"
+        << std::setw(14) << "p99 wait us" << "\n";
+    for (const Histogram *h : waits)
+    {
+        uint64_t n = h->count();
+        uint64_t b = 0;
+        for (const Counter *c : busy)
+            if (c->label("lock") == h->label("lock") && h->label("mode") == "exclusive")
+                b = c->value();
+        out << std::left << std::setw(24) << h->label("lock") << std::setw(11) << h->label("mode") << std::right
+            << std::setw(12) << n << std::setw(10) << b << std::fixed << std::setprecision(1)
+            << std::setw(14) << (n ? h->sum() / n * 1e6 : 0.0) << std::setw(14) << h->quantile(0.99) * 1e6 << "\n";
+    }
+    out.unsetf(std::ios::floatfield);
+}
+
+inline void writeOperationTable(std::ostream &out)
+{
+    auto results = Registry::get().children<Counter>("operations_total");
+    auto timings = Registry::get().children<Histogram>("operation_seconds");
+    double uptime = std::max(Registry::get().uptime(), 1e-9);
+
+    out << std::left << std::setw(24) << "Operation" << std::right << std::setw(10) << "Ok"
+        << std::setw(10) << "Error" << std::setw(10) << "Busy" << std::setw(10) << "Per sec"
+        << std::setw(14) << "p99 us" << "\n";
+    for (const Histogram *h : timings)
+    {
+        uint64_t ok = 0, error = 0, busy = 0;
+        for (const Counter *c : results)
+        {
+            if (c->label("op") != h->label("op"))
+                continue;
+            std::string r = c->label("result");
+            (r == "ok" ? ok : r == "error" ? error : busy) = c->value();
+        }
+        if (ok + error + busy == 0)
+            continue;
+        out << std::left << std::setw(24) << h->label("op") << std::right << std::setw(10) << ok
+            << std::setw(10) << error << std::setw(10) << busy << std::fixed << std::setprecision(1)
+            << std::setw(10) << (ok + error + busy) / uptime << std::setw(14) << h->quantile(0.99) * 1e6 << "\n";
+    }
+    out.unsetf(std::ios::floatfield);
+}
+
+// Publishes the registry: rewrites `path` every interval (through a
+// temporary file, so readers never see half a scrape) and/or answers
+// GET /metrics on 127.0.0.1:port. Either may be left empty/0.
+class Exporter
+{
+public:
+    Exporter(std::string path, int port, std::chrono::milliseconds interval)
+        : path(std::move(path)), port(port), interval(interval)
+    {
+    }
+
+    ~Exporter() { stop(); }
+
+    Exporter(const Exporter &) = delete;
+    Exporter &operator=(const Exporter &) = delete;
+
+    // False if the HTTP port could not be opened
+    bool start()
+    {
+        if (path.empty() && port <= 0)
+            return true;
+#ifndef _WIN32
+        if (port > 0)
+        {
+            listenFd = socket(AF_INET, SOCK_STREAM, 0);
+            int on = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+            sockaddr_in addr{};
+            addr.sin_family      = AF_INET;
+            addr.sin_port        = htons(static_cast<uint16_t>(port));
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 ||
+                listen(listenFd, 16) < 0)
+            {
+                if (listenFd >= 0)
+                    close(listenFd);
+                listenFd = -1;
+                return false;
+            }
+        }
+#else
+        if (port > 0)
+            return false;
+#endif
+        running = true;
+        worker  = std::thread(&Exporter::run, this);
+        return true;
+    }
+
+    // Joins the thread and leaves a final scrape in the file
+    void stop()
+    {
+        if (!worker.joinable())
+            return;
+        running = false;
+        worker.join();
+        if (!path.empty())
+            writeFile();
+#ifndef _WIN32
+        if (listenFd >= 0)
+            close(listenFd);
+        listenFd = -1;
+#endif
+    }
+
+private:
+    // Waits in short steps so stop() returns promptly
+    static constexpr int STEP_MS = 100;
+
+    void run()
+    {
+        auto next = std::chrono::steady_clock::now();
+        while (running)
+        {
+            if (!path.empty() && std::chrono::steady_clock::now() >= next)
+            {
+                writeFile();
+                next += interval;
+            }
+#ifndef _WIN32
+            if (listenFd >= 0)
+            {
+                pollfd p{listenFd, POLLIN, 0};
+                if (poll(&p, 1, STEP_MS) > 0)
+                    serveOne();
+                continue;
+            }
+#endif
+            std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MS));
+        }
+    }
+
+    void writeFile()
+    {
+        std::string tmp  = path + ".tmp";
+        std::string body = Registry::get().text();
+        FILE *f = fopen(tmp.c_str(), "w");
+        if (!f)
+            return;
+        bool ok = fwrite(body.data(), 1, body.size(), f) == body.size();
+        ok = fclose(f) == 0 && ok;
+        if (ok)
+            std::rename(tmp.c_str(), path.c_str());
+    }
+
+#ifndef _WIN32
+    // One request per connection; anything but GET /metrics (or /) is a 404
+    void serveOne()
+    {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+            return;
+        timeval timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+        {
+            ssize_t n = recv(fd, buf, sizeof buf, 0);
+            if (n <= 0)
+                break;
+            request.append(buf, static_cast<size_t>(n));
+        }
+
+        std::string status = "404 Not Found", body = "Not found\n";
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+        {
+            status = "200 OK";
+            body   = Registry::get().text();
+        }
+        std::string response = "HTTP/1.1 " + status +
+                               "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                               std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        for (size_t sent = 0; sent < response.size();)
+        {
+            ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += static_cast<size_t>(n);
+        }
+        close(fd);
+    }
+
+    int listenFd = -1;
+#endif
+
+    const std::string               path;
+    const int                       port;
+    const std::chrono::milliseconds interval;
+    std::atomic<bool>               running{false};
+    std::thread                     worker;
+};
+
+} // namespace metrics
+
+#endif // METRICS_H
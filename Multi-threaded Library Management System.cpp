@@ -1,23 +1,47 @@
 // Multi-Threaded Library Management System
 // A simple, thread-safe library system supporting admin and user roles.
 // Admins can manage the book catalog; users can borrow/return books and check availability.
+// Run with --replay <script> [--paced] to replay recorded sessions headlessly, or
+// --simulate <n> [--sim-seed <s>] [--sim-trace] to explore thread schedules.
 
 #include <iostream>
 #include <string>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <fstream>
+#include <cstdio>
+#include <ctime>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <string_view>
 #include <sstream>
 #include <limits>
 #include <cstdlib>
 #include <cctype>
 #include <iomanip>
 #include <algorithm>   
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include "DeterministicSim.h"
+#include "Tracing.h"
+#include "Metrics.h"
+#include "EpochReclaim.h"
 
 using namespace std;
 
 // Global mutex to synchronize console I/O across threads
-static mutex io_mutex;
+static TRACE_LOCKABLE(mutex, io_mutex);
 
 // Clear the terminal screen (cross-platform)
 inline void clearScreen()
@@ -38,7 +62,7 @@ int getMenuChoice()
     while (true)
     {
         {
-            lock_guard<mutex> io(io_mutex);
+            lock_guard io(io_mutex);
             cout << "Choice: " << flush;
         }
 
@@ -50,13 +74,13 @@ int getMenuChoice()
             return choice;
 
         {
-            lock_guard<mutex> io(io_mutex);
+            lock_guard io(io_mutex);
             cout << "Invalid input. Please enter a number.\n" << flush;
         }
     }
 }
 
-// Reader-writer lock with writer preference
+// Reader-writer lock with writer preference; scheduled by sim:: under --simulate
 class RWLock
 {
 public:
@@ -67,530 +91,2983 @@ public:
     bool tryLockWrite();
 
 private:
-    mutex              mtx;
-    condition_variable cv;
+    sim::Mutex         mtx;
+    sim::CondVar       cv;
     int                 activeReaders  = 0;
     int                 waitingWriters = 0;
     bool                writerActive   = false;
+
+    // Shared by every branch's lock
+    static metrics::Histogram &readWaits;
+    static metrics::Histogram &writeWaits;
+    static metrics::Counter   &busyCount;
 };
 
+metrics::Histogram &RWLock::readWaits  = metrics::lockWaits("booksLock", "shared");
+metrics::Histogram &RWLock::writeWaits = metrics::lockWaits("booksLock", "exclusive");
+metrics::Counter   &RWLock::busyCount  = metrics::lockBusy("booksLock");
+
 void RWLock::lockRead()
 {
-    unique_lock<mutex> lk(mtx);
+    TRACE_WAIT_BEGIN();
+    uint64_t start = metrics::now();
+    unique_lock<sim::Mutex> lk(mtx);
     cv.wait(lk, [&]() { return !writerActive && waitingWriters == 0; });
     ++activeReaders;
+    readWaits.observeNs(metrics::now() - start);
+    TRACE_ACQUIRED(this, "wait RWLock read");
 }
 
 void RWLock::unlockRead()
 {
-    unique_lock<mutex> lk(mtx);
+    TRACE_RELEASED(this, "hold RWLock read");
+    unique_lock<sim::Mutex> lk(mtx);
     if (--activeReaders == 0)
         cv.notify_all();
 }
 
 void RWLock::lockWrite()
 {
-    unique_lock<mutex> lk(mtx);
+    TRACE_WAIT_BEGIN();
+    uint64_t start = metrics::now();
+    unique_lock<sim::Mutex> lk(mtx);
     ++waitingWriters;
     cv.wait(lk, [&]() { return !writerActive && activeReaders == 0; });
     --waitingWriters;
     writerActive = true;
+    writeWaits.observeNs(metrics::now() - start);
+    TRACE_ACQUIRED(this, "wait RWLock write");
 }
 
 void RWLock::unlockWrite()
 {
-    unique_lock<mutex> lk(mtx);
+    TRACE_RELEASED(this, "hold RWLock write");
+    unique_lock<sim::Mutex> lk(mtx);
     writerActive = false;
     cv.notify_all();
 }
 
 bool RWLock::tryLockWrite()
 {
-    unique_lock<mutex> lk(mtx, try_to_lock);
+    unique_lock<sim::Mutex> lk(mtx, try_to_lock);
     if (!lk.owns_lock() || writerActive || activeReaders > 0)
+    {
+        busyCount.inc();
         return false;
+    }
     writerActive = true;
+    writeWaits.observe(0);
+    TRACE_TRY_ACQUIRED(this);
     return true;
 }
 
-// Book record
-struct Book
+// Count-min sketch with atomic cells; safe for concurrent adds
+class CountMinSketch
 {
-    string title;
-    string author;
-    int    count;
-    int    id;
+public:
+    static constexpr int    DEPTH = 4;
+    static constexpr size_t WIDTH = 4096;   // must be a power of two
+
+    void     add(uint64_t key, uint32_t n);
+    uint32_t estimate(uint64_t key) const;
+
+private:
+    static size_t cell(int row, uint64_t key);
+
+    atomic<uint32_t> table[DEPTH][WIDTH]{};
 };
 
-// User account record
-struct Account
+// Row hashes derived from one 64-bit mix (Kirsch-Mitzenmacher)
+size_t CountMinSketch::cell(int row, uint64_t key)
 {
-    string        username;
-    string        firstName;
-    string        middleName;
-    string        lastName;
-    string        password;
-    int           id;
-    bool          loggedIn;
-    bool          isAdmin;
+    key ^= key >> 33; key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33; key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
 
-    // NEW: which book IDs this user currently has borrowed
-    vector<int>   borrowedBookIds;
-};
+    uint32_t h1 = static_cast<uint32_t>(key);
+    uint32_t h2 = static_cast<uint32_t>(key >> 32) | 1u;
+    return (h1 + static_cast<uint32_t>(row) * h2) & (WIDTH - 1);
+}
 
-// Main library class
-class Library
+void CountMinSketch::add(uint64_t key, uint32_t n)
 {
-public:
-    Library();
-    void registerUser();
-    int  loginUser();
-    void userSession(int idx);
+    for (int r = 0; r < DEPTH; ++r)
+        table[r][cell(r, key)].fetch_add(n, memory_order_relaxed);
+}
 
-private:
-    void listAllBooks();
-    void addBook();
-    void updateBook();
-    void removeBook();
-    void borrowBook();
-    void returnBook();
-    void checkAvailability();
-    void displayLockStatus();
-    void detectDeadlocks();
-    void ensureFairness();
+uint32_t CountMinSketch::estimate(uint64_t key) const
+{
+    uint32_t best = numeric_limits<uint32_t>::max();
+    for (int r = 0; r < DEPTH; ++r)
+        best = min(best, table[r][cell(r, key)].load(memory_order_relaxed));
+    return best;
+}
 
-    int   findBookIndex(const string &title);
-    bool  validPassword(const string &pwd);
+// Approximate top-K book IDs for one event stream.
+// record() only appends to a per-thread buffer; the sketch and the
+// top-K heap are updated when that buffer fills, and top() drains every
+// thread's buffer first. A buffer's mutex is only ever contended while
+// top() drains it. Buffers outlive their threads, so nothing a thread
+// recorded before exiting is lost.
+class HeavyHitters
+{
+public:
+    static constexpr int BUFFER_SIZE = 32;
 
-    vector<Book>    books;
-    vector<Account> accounts;
+    explicit HeavyHitters(size_t k);
+    ~HeavyHitters();
 
-    // track which account is currently active
-    int             currentUserIdx = -1;
+    void record(int bookId);
+    vector<pair<int, uint32_t>> top();   // (book ID, estimate), highest first
 
-    RWLock            booksLock;
-    recursive_mutex   updateMutex;
-    mutex             cvMutex;
-    condition_variable bookCv;
-    mutex             accountMutex;
+private:
+    struct LocalBuffer
+    {
+        mutex        bufMutex;
+        int          ids[BUFFER_SIZE];
+        int          used = 0;
+        atomic<bool> retired{false};   // its tracker is gone
+    };
+
+    LocalBuffer &localBuffer();
+    void         apply(LocalBuffer &buf);   // caller holds buf.bufMutex
+    void         drain();
+
+    static atomic<uint64_t> trackerIds;
+
+    uint64_t                         id;
+    size_t                           k;
+    CountMinSketch                   sketch;
+    mutex                            heapMutex;
+    vector<pair<uint32_t, int>>      heap;      // min-heap on estimate
+    mutex                            buffersMutex;
+    vector<shared_ptr<LocalBuffer>>  buffers;   // one per recording thread
 };
 
-// Default admin account information
-Library::Library()
+atomic<uint64_t> HeavyHitters::trackerIds{0};
+
+HeavyHitters::HeavyHitters(size_t k)
+    : id(trackerIds.fetch_add(1) + 1), k(k)
 {
-    accounts.push_back({
-        "admin",
-        "Administrator",
-        "",
-        "",
-        "password",
-        1,
-        false,
-        true,
-        {}              // borrowedBookIds empty
-    });
 }
 
-// Find book by title
-int Library::findBookIndex(const string &title)
+// Threads still holding one of our buffers drop it on their next miss
+HeavyHitters::~HeavyHitters()
 {
-    for (size_t i = 0; i < books.size(); ++i)
-        if (books[i].title == title)
-            return static_cast<int>(i);
-    return -1;
+    for (auto &buf : buffers)
+        buf->retired.store(true);
 }
 
-// Password strength check
-bool Library::validPassword(const string &pwd)
+HeavyHitters::LocalBuffer &HeavyHitters::localBuffer()
 {
-    if (pwd.size() < 8) return false;
-
-    bool upper   = false;
-    bool lower   = false;
-    bool digit   = false;
-    bool special = false;
-
-    for (char c : pwd)
+    thread_local vector<pair<uint64_t, shared_ptr<LocalBuffer>>> mine;
+    for (auto &entry : mine)
+        if (entry.first == id)
+            return *entry.second;
+
+    mine.erase(remove_if(mine.begin(), mine.end(),
+                         [](const pair<uint64_t, shared_ptr<LocalBuffer>> &e) { return e.second->retired.load(); }),
+               mine.end());
+    auto buf = make_shared<LocalBuffer>();
     {
-        upper   |= isupper((unsigned char)c);
-        lower   |= islower((unsigned char)c);
-        digit   |= isdigit((unsigned char)c);
-        special |= ispunct((unsigned char)c);
+        lock_guard<mutex> lk(buffersMutex);
+        buffers.push_back(buf);
     }
-
-    return upper && lower && digit && special;
+    mine.push_back({id, buf});
+    return *buf;
 }
 
-// Register a new user
-void Library::registerUser()
+// Hot path: an uncontended lock, one store and a counter bump
+void HeavyHitters::record(int bookId)
 {
-    lock_guard<mutex> lk(accountMutex);
-
-    string first, middle, last, pwd, confirm;
-    {
-        lock_guard<mutex> io(io_mutex);
-        cout << "First Name: " << flush;
-    }
-    getline(cin, first);
+    LocalBuffer      &buf = localBuffer();
+    lock_guard<mutex> lk(buf.bufMutex);
+    buf.ids[buf.used++] = bookId;
+    if (buf.used == BUFFER_SIZE)
+        apply(buf);
+}
 
+// Fold every thread's buffered IDs in; buffers of exited threads are
+// dropped once drained
+void HeavyHitters::drain()
+{
+    lock_guard<mutex> lk(buffersMutex);
+    for (auto it = buffers.begin(); it != buffers.end();)
     {
-        lock_guard<mutex> io(io_mutex);
-        cout << "Middle Name: " << flush;
+        bool orphaned = it->use_count() == 1;   // checked first: an exited thread adds nothing more
+        {
+            lock_guard<mutex> b((*it)->bufMutex);
+            if ((*it)->used > 0)
+                apply(**it);
+        }
+        if (orphaned)
+            it = buffers.erase(it);
+        else
+            ++it;
     }
-    getline(cin, middle);
+}
 
-    {
-        lock_guard<mutex> io(io_mutex);
-        cout << "Last Name: " << flush;
-    }
-    getline(cin, last);
+// Fold a buffer into the sketch, then refresh the heap with new estimates
+void HeavyHitters::apply(LocalBuffer &buf)
+{
+    sort(buf.ids, buf.ids + buf.used);
 
-    string uname = first.substr(0,1) + middle.substr(0,1) + last;
+    vector<pair<uint32_t, int>> updates;
+    for (int i = 0; i < buf.used; )
     {
-        lock_guard<mutex> io(io_mutex);
-        cout << "Your username: " << uname << '\n' << flush;
+        int j = i;
+        while (j < buf.used && buf.ids[j] == buf.ids[i])
+            ++j;
+        sketch.add(static_cast<uint64_t>(buf.ids[i]), static_cast<uint32_t>(j - i));
+        updates.push_back({sketch.estimate(static_cast<uint64_t>(buf.ids[i])), buf.ids[i]});
+        i = j;
     }
+    buf.used = 0;
 
-    while (true)
+    lock_guard<mutex> lk(heapMutex);
+    for (auto &u : updates)
     {
+        auto it = find_if(heap.begin(), heap.end(),
+                          [&](const pair<uint32_t, int> &e) { return e.second == u.second; });
+        if (it != heap.end())
         {
-            lock_guard<mutex> io(io_mutex);
-            cout << "Password (Minimum of 8 chars, must include upper/lower/digit/special): " << flush;
-        }
-        getline(cin, pwd);
-
-        if (!validPassword(pwd))
-        {
-            lock_guard<mutex> io(io_mutex);
-            cout << "Weak password.\n" << flush;
-            continue;
-        }
-
-        {
-            lock_guard<mutex> io(io_mutex);
-            cout << "Confirm password: " << flush;
+            it->first = max(it->first, u.first);
+            make_heap(heap.begin(), heap.end(), greater<>());
         }
-        getline(cin, confirm);
-
-        if (pwd != confirm)
+        else if (heap.size() < k)
         {
-            lock_guard<mutex> io(io_mutex);
-            cout << "Passwords do not match.\n" << flush;
+            heap.push_back(u);
+            push_heap(heap.begin(), heap.end(), greater<>());
         }
-        else
+        else if (u.first > heap.front().first)
         {
-            break;
+            pop_heap(heap.begin(), heap.end(), greater<>());
+            heap.back() = u;
+            push_heap(heap.begin(), heap.end(), greater<>());
         }
     }
+}
 
-    accounts.push_back({
-        uname,
-        first,
-        middle,
-        last,
-        pwd,
-        static_cast<int>(accounts.size()) + 1,
-        false,
-        false,
-        {}   // start with no borrowed books
-    });
+vector<pair<int, uint32_t>> HeavyHitters::top()
+{
+    drain();
 
+    vector<pair<uint32_t, int>> snapshot;
     {
-        lock_guard<mutex> io(io_mutex);
-        cout << "User registered with ID: " << accounts.back().id << '\n' << flush;
+        lock_guard<mutex> lk(heapMutex);
+        snapshot = heap;
     }
+    sort(snapshot.begin(), snapshot.end(), greater<>());
+
+    vector<pair<int, uint32_t>> result;
+    for (auto &e : snapshot)
+        result.push_back({e.second, e.first});
+    return result;
 }
 
-// Login user
-int Library::loginUser()
+// "Patrons who borrowed X also borrowed" index.
+// borrowBook only queues an event; a background thread applies queued
+// events in batches and keeps the top-N neighbours of each book current.
+class CoBorrowIndex
 {
-    string uname, pwd;
+public:
+    static constexpr size_t TOP_N = 5;
+
+    CoBorrowIndex();
+    ~CoBorrowIndex();
+
+    void submit(int bookId, const vector<int> &heldIds);
+    vector<pair<int, uint32_t>> neighbors(int bookId);   // (book ID, co-borrows), highest first
 
+private:
+    struct Event
     {
-        lock_guard<mutex> io(io_mutex);
-        cout << "Username: " << flush;
+        int         bookId;
+        vector<int> heldIds;
+    };
+
+    void run();
+    void applyBatch(vector<Event> &batch);
+    void bump(int from, int to);
+
+    mutex              queueMutex;
+    condition_variable queueCv;
+    vector<Event>      pending;
+    bool               stopping = false;
+
+    shared_mutex                                       indexMutex;
+    unordered_map<int, unordered_map<int, uint32_t>>   counts;
+    unordered_map<int, vector<pair<uint32_t, int>>>    topNeighbors;   // sorted, at most TOP_N
+
+    thread worker;
+};
+
+CoBorrowIndex::CoBorrowIndex()
+    : worker(&CoBorrowIndex::run, this)
+{
+}
+
+CoBorrowIndex::~CoBorrowIndex()
+{
+    {
+        lock_guard<mutex> lk(queueMutex);
+        stopping = true;
     }
-    getline(cin, uname);
+    queueCv.notify_one();
+    worker.join();
+}
+
+// Called on the borrow path: one short critical section, no index work
+void CoBorrowIndex::submit(int bookId, const vector<int> &heldIds)
+{
+    if (heldIds.empty())
+        return;
 
+    bool wasEmpty;
     {
-        lock_guard<mutex> io(io_mutex);
-        cout << "Password: " << flush;
+        lock_guard<mutex> lk(queueMutex);
+        wasEmpty = pending.empty();
+        pending.push_back({bookId, heldIds});
     }
-    getline(cin, pwd);
+    if (wasEmpty)
+        queueCv.notify_one();
+}
 
-    lock_guard<mutex> lk(accountMutex);
-    for (auto &acct : accounts)
+void CoBorrowIndex::run()
+{
+    TRACE_THREAD_NAME("co-borrow index");
+    vector<Event> batch;
+    while (true)
     {
-        if (acct.username == uname && acct.password == pwd)
         {
-            acct.loggedIn = true;
-            lock_guard<mutex> io(io_mutex);
-            cout << "Welcome, " << acct.firstName << "!\n" << flush;
-            return acct.id - 1;
+            unique_lock<mutex> lk(queueMutex);
+            queueCv.wait(lk, [&]() { return stopping || !pending.empty(); });
+            if (pending.empty())
+                return;
+            batch.swap(pending);
         }
+        applyBatch(batch);
+        batch.clear();
     }
+}
 
+void CoBorrowIndex::applyBatch(vector<Event> &batch)
+{
+    unique_lock<shared_mutex> lk(indexMutex);
+    for (auto &e : batch)
     {
-        lock_guard<mutex> io(io_mutex);
-        cout << "Invalid credentials.\n" << flush;
+        for (int other : e.heldIds)
+        {
+            if (other == e.bookId)
+                continue;
+            bump(e.bookId, other);
+            bump(other, e.bookId);
+        }
     }
-    return -1;
 }
 
-// List all books
-void Library::listAllBooks()
+// Increment one directed pair and fix up that book's top-N list
+void CoBorrowIndex::bump(int from, int to)
 {
-    lock_guard<mutex> io(io_mutex);
-    booksLock.lockRead();
-
-    if (books.empty())
-    {
-        cout << "No books in the library.\n";
-    }
+    uint32_t c = ++counts[from][to];
+
+    auto &top = topNeighbors[from];
+    auto it = find_if(top.begin(), top.end(),
+                      [&](const pair<uint32_t, int> &e) { return e.second == to; });
+    if (it != top.end())
+        it->first = c;
+    else if (top.size() < TOP_N)
+        top.push_back({c, to});
+    else if (c > top.back().first)
+        top.back() = {c, to};
     else
-    {
-        constexpr int ID_W = 4, T_W = 40, A_W = 30, C_W = 6;
-        cout << left
-             << setw(ID_W) << "ID"
-             << setw(T_W) << "Title"
-             << setw(A_W) << "Author"
-             << setw(C_W) << "Count" << "\n";
-        cout << string(ID_W + T_W + A_W + C_W, '-') << "\n";
+        return;
 
-        for (auto &b : books)
-        {
-            cout << left
-                 << setw(ID_W) << b.id
-                 << setw(T_W) << b.title
-                 << setw(A_W) << b.author
-                 << setw(C_W) << b.count << "\n";
-        }
-    }
+    sort(top.begin(), top.end(), greater<>());
+}
 
-    booksLock.unlockRead();
+vector<pair<int, uint32_t>> CoBorrowIndex::neighbors(int bookId)
+{
+    vector<pair<int, uint32_t>> result;
+
+    shared_lock<shared_mutex> lk(indexMutex);
+    auto it = topNeighbors.find(bookId);
+    if (it != topNeighbors.end())
+        for (auto &e : it->second)
+            result.push_back({e.second, e.first});
+    return result;
 }
 
-// Add book
-void Library::addBook()
+// Book record
+struct Book
 {
-    lock_guard<mutex> io(io_mutex);
+    string title;
+    string author;
+    int    count;
+    int    id;
+};
 
-    cout << "Book title: " << flush;
-    string t; getline(cin, t);
+// Interned author names. IDs are dense and never reused; id -> name reads
+// are lock-free because published entries are never moved or modified.
+class AuthorTable
+{
+public:
+    static constexpr uint32_t BLOCK      = 1024;
+    static constexpr uint32_t MAX_BLOCKS = 4096;
 
-    cout << "Author: " << flush;
-    string a; getline(cin, a);
+    AuthorTable() = default;
+    AuthorTable(const AuthorTable &) = delete;
+    AuthorTable &operator=(const AuthorTable &) = delete;
+    ~AuthorTable();
 
-    cout << "Quantity: " << flush;
-    int c; cin >> c;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    uint32_t      intern(const string &name);               // writers only
+    bool          lookup(const string &name, uint32_t &id);
+    const string &name(uint32_t id) const;
 
-    booksLock.lockWrite();
-    books.push_back({t, a, c, static_cast<int>(books.size()) + 1});
-    booksLock.unlockWrite();
+private:
+    atomic<string *>                   blocks[MAX_BLOCKS]{};
+    uint32_t                           size = 0;
+    shared_mutex                       idsMutex;
+    unordered_map<string, uint32_t>    ids;
+};
 
-    cout << "Added '" << t << "'.\n" << flush;
+AuthorTable::~AuthorTable()
+{
+    for (auto &b : blocks)
+        delete[] b.load();
 }
 
-// Update book
-void Library::updateBook()
+uint32_t AuthorTable::intern(const string &name)
 {
-    lock_guard<recursive_mutex> rec(updateMutex);
-    lock_guard<mutex>            io(io_mutex);
+    uint32_t id;
+    if (lookup(name, id))
+        return id;
 
-    cout << "Title to update: " << flush;
-    string t; getline(cin, t);
+    id = size;
+    if (id / BLOCK >= MAX_BLOCKS)
+        abort();
 
-    booksLock.lockWrite();
-    int idx = findBookIndex(t);
-    if (idx < 0)
+    string *block = blocks[id / BLOCK].load(memory_order_relaxed);
+    if (!block)
     {
-        cout << "Book not found.\n" << flush;
-        booksLock.unlockWrite();
-        return;
+        block = new string[BLOCK];
+        blocks[id / BLOCK].store(block, memory_order_release);
     }
+    block[id % BLOCK] = name;
+    ++size;
 
-    cout << "New title: " << flush;  getline(cin, books[idx].title);
-    cout << "New author: " << flush; getline(cin, books[idx].author);
-    cout << "New qty: " << flush;    cin >> books[idx].count;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    unique_lock<shared_mutex> lk(idsMutex);
+    ids.emplace(name, id);
+    return id;
+}
+
+bool AuthorTable::lookup(const string &name, uint32_t &id)
+{
+    shared_lock<shared_mutex> lk(idsMutex);
+    auto it = ids.find(name);
+    if (it == ids.end())
+        return false;
+    id = it->second;
+    return true;
+}
 
-    booksLock.unlockWrite();
-    cout << "Book updated.\n" << flush;
+const string &AuthorTable::name(uint32_t id) const
+{
+    return blocks[id / BLOCK].load(memory_order_acquire)[id % BLOCK];
 }
 
-// Remove book
-void Library::removeBook()
+inline uint64_t titleHash(string_view title)
 {
-    lock_guard<mutex> io(io_mutex);
+    return hash<string_view>{}(title);
+}
 
-    cout << "Title to remove: " << flush;
-    string t; getline(cin, t);
+// Fixed-size run of catalog slots, stored column-wise so a scan over IDs,
+// counts or title hashes stays in a few dense arrays. Titles are packed
+// into one arena per chunk. Book ID n always lives in slot n - 1; a removed
+// book keeps its slot with id 0 so later IDs never shift.
+struct CatalogChunk
+{
+    static constexpr int CAPACITY = 64;
+
+    int       used = 0;
+    int       ids[CAPACITY];
+    int       counts[CAPACITY];
+    uint64_t  titleHashes[CAPACITY];
+    uint32_t  authorIds[CAPACITY];
+    uint32_t  versions[CAPACITY];       // bumped by every change to the row
+    uint32_t  titleOffsets[CAPACITY];
+    uint32_t  titleLengths[CAPACITY];
+    string    titleArena;
+
+    string_view title(int row) const
+    {
+        return string_view(titleArena).substr(titleOffsets[row], titleLengths[row]);
+    }
+
+    void setTitle(int row, string_view t);
+};
+
+// Append the new title; repack the arena once dead bytes dominate
+void CatalogChunk::setTitle(int row, string_view t)
+{
+    titleOffsets[row]  = static_cast<uint32_t>(titleArena.size());
+    titleLengths[row]  = static_cast<uint32_t>(t.size());
+    titleHashes[row]   = titleHash(t);
+    titleArena.append(t.data(), t.size());
+
+    size_t live = 0;
+    for (int i = 0; i < used; ++i)
+        live += titleLengths[i];
+    if (titleArena.size() <= 2 * live + 256)
+        return;
+
+    string packed;
+    packed.reserve(live);
+    for (int i = 0; i < used; ++i)
+    {
+        uint32_t off = static_cast<uint32_t>(packed.size());
+        packed.append(titleArena, titleOffsets[i], titleLengths[i]);
+        titleOffsets[i] = off;
+    }
+    titleArena.swap(packed);
+}
+
+// Read-only handle to one catalog row; valid while its ReadView is alive
+class BookRef
+{
+public:
+    BookRef() = default;
+    BookRef(const CatalogChunk *c, int r, const AuthorTable *a) : chunk(c), row(r), authors(a) {}
+
+    explicit operator bool() const { return chunk != nullptr; }
+
+    int           id() const       { return chunk->ids[row]; }
+    int           count() const    { return chunk->counts[row]; }
+    uint32_t      authorId() const { return chunk->authorIds[row]; }
+    uint32_t      version() const  { return chunk->versions[row]; }
+    string_view   title() const    { return chunk->title(row); }
+    const string &author() const   { return authors->name(authorId()); }
+
+private:
+    const CatalogChunk *chunk   = nullptr;
+    int                 row     = 0;
+    const AuthorTable  *authors = nullptr;
+};
+
+// Per-author index entry: the author's book IDs plus running aggregates
+struct AuthorEntry
+{
+    shared_ptr<const vector<int>> bookIds;
+    long                          copies = 0;   // available copies across all titles
+};
+
+// Fixed-size run of author index entries, keyed by author ID
+struct AuthorIndexChunk
+{
+    static constexpr uint32_t CAPACITY = 64;
+
+    AuthorEntry entries[CAPACITY];
+};
+
+// One immutable, published version of the catalog. Unchanged chunks are
+// shared with the previous version.
+struct CatalogVersion
+{
+    uint64_t                                    version = 0;
+    size_t                                      slots   = 0;
+    vector<shared_ptr<const CatalogChunk>>      chunks;
+    vector<shared_ptr<const AuthorIndexChunk>>  authorChunks;
+    const AuthorTable                          *authors = nullptr;
+
+    BookRef            findById(int id) const;
+    BookRef            findByTitle(string_view title) const;
+    BookRef            findByTitle(string_view title, string_view author) const;
+    const AuthorEntry *authorEntry(uint32_t authorId) const;
+
+    template <typename Fn>
+    void forEach(Fn fn) const
+    {
+        for (auto &c : chunks)
+            for (int r = 0; r < c->used; ++r)
+                if (c->ids[r] != 0)
+                    fn(BookRef(c.get(), r, authors));
+    }
+
+    // O(k) in the author's title count, via the author index
+    template <typename Fn>
+    void forEachByAuthor(uint32_t authorId, Fn fn) const
+    {
+        const AuthorEntry *e = authorEntry(authorId);
+        if (e && e->bookIds)
+            for (int id : *e->bookIds)
+                fn(findById(id));
+    }
+};
+
+const AuthorEntry *CatalogVersion::authorEntry(uint32_t authorId) const
+{
+    size_t chunk = authorId / AuthorIndexChunk::CAPACITY;
+    if (chunk >= authorChunks.size())
+        return nullptr;
+    return &authorChunks[chunk]->entries[authorId % AuthorIndexChunk::CAPACITY];
+}
+
+BookRef CatalogVersion::findById(int id) const
+{
+    if (id <= 0 || static_cast<size_t>(id) > slots)
+        return {};
+
+    size_t              slot = static_cast<size_t>(id) - 1;
+    const CatalogChunk *c    = chunks[slot / CatalogChunk::CAPACITY].get();
+    int                 r    = static_cast<int>(slot % CatalogChunk::CAPACITY);
+    return c->ids[r] != 0 ? BookRef(c, r, authors) : BookRef();
+}
+
+// Compare hashes first; the arena is only read on a hash match
+BookRef CatalogVersion::findByTitle(string_view title) const
+{
+    uint64_t h = titleHash(title);
+    for (auto &c : chunks)
+        for (int r = 0; r < c->used; ++r)
+            if (c->titleHashes[r] == h && c->ids[r] != 0 && c->title(r) == title)
+                return BookRef(c.get(), r, authors);
+    return {};
+}
+
+// The row with this title by this author; other authors' books of the
+// same title don't match
+BookRef CatalogVersion::findByTitle(string_view title, string_view author) const
+{
+    uint64_t h = titleHash(title);
+    for (auto &c : chunks)
+        for (int r = 0; r < c->used; ++r)
+            if (c->titleHashes[r] == h && c->ids[r] != 0 && c->title(r) == title)
+            {
+                BookRef b(c.get(), r, authors);
+                if (b.author() == author)
+                    return b;
+            }
+    return {};
+}
+
+// Copy-on-write catalog. Readers load the current version with no locks;
+// writers (serialized by the caller) stage edits in a Batch and publish
+// them with one pointer swap. Old versions are freed once no view holds them.
+class Catalog
+{
+public:
+    // Pins the version current at construction time. Views may live across
+    // console output, so they hold a hazard on that one version rather than
+    // an epoch section that would hold back every later retirement.
+    class ReadView
+    {
+    public:
+        explicit ReadView(Catalog &c) : ver(c.epochs, c.current) {}
+        const CatalogVersion *operator->() const { return ver.get(); }
+        const CatalogVersion &operator*() const  { return *ver; }
+
+    private:
+        reclaim::Hazard<const CatalogVersion> ver;
+    };
+
+    // Edits against the latest version; nothing is visible until publish()
+    class Batch
+    {
+    public:
+        explicit Batch(Catalog &c);
+
+        enum class EditResult { Applied, Conflict, Missing };
+
+        int        append(const string &title, const string &author, int count);   // returns the new ID
+        bool       update(int id, const string &title, const string &author, int count);
+        EditResult updateIf(int id, uint32_t expectedVersion,
+                            const string &title, const string &author, int count);
+        int  adjustCount(int id, int delta);                                 // new count, or -1
+        bool remove(int id);
+        void publish();
+
+    private:
+        CatalogChunk *ownRow(int id, int &row);
+        CatalogChunk *ownChunk(size_t index);
+        AuthorEntry  &ownAuthor(uint32_t authorId);
+        void          linkAuthor(uint32_t authorId, int id, long copies);
+        void          unlinkAuthor(uint32_t authorId, int id, long copies);
+
+        Catalog                      &cat;
+        unique_ptr<CatalogVersion>    next;
+        vector<CatalogChunk *>        owned;         // chunks already copied in this batch
+        vector<AuthorIndexChunk *>    ownedAuthors;  // same, for the author index
+    };
+
+    Catalog();
+    ~Catalog();
+
+    AuthorTable &authorTable() { return authors; }
+
+    // Latest version; only valid while holding the writer lock
+    const CatalogVersion &latest() const { return *current.load(memory_order_relaxed); }
+
+private:
+    AuthorTable                    authors;
+    atomic<const CatalogVersion *> current;
+    reclaim::Domain                epochs{1};   // versions are large: collect on every publish
+};
+
+Catalog::Catalog()
+    : current(nullptr)
+{
+    auto *first    = new CatalogVersion();
+    first->authors = &authors;
+    current.store(first);
+}
+
+Catalog::~Catalog()
+{
+    delete current.load();
+}
+
+Catalog::Batch::Batch(Catalog &c)
+    : cat(c), next(new CatalogVersion(c.latest())),
+      owned(next->chunks.size(), nullptr),
+      ownedAuthors(next->authorChunks.size(), nullptr)
+{
+    ++next->version;
+}
+
+CatalogChunk *Catalog::Batch::ownChunk(size_t index)
+{
+    if (!owned[index])
+    {
+        auto copy = make_shared<CatalogChunk>(*next->chunks[index]);
+        owned[index] = copy.get();
+        next->chunks[index] = move(copy);
+    }
+    return owned[index];
+}
+
+AuthorEntry &Catalog::Batch::ownAuthor(uint32_t authorId)
+{
+    size_t index = authorId / AuthorIndexChunk::CAPACITY;
+    while (next->authorChunks.size() <= index)
+    {
+        auto fresh = make_shared<AuthorIndexChunk>();
+        ownedAuthors.push_back(fresh.get());
+        next->authorChunks.push_back(move(fresh));
+    }
+
+    if (!ownedAuthors[index])
+    {
+        auto copy = make_shared<AuthorIndexChunk>(*next->authorChunks[index]);
+        ownedAuthors[index] = copy.get();
+        next->authorChunks[index] = move(copy);
+    }
+    return ownedAuthors[index]->entries[authorId % AuthorIndexChunk::CAPACITY];
+}
+
+void Catalog::Batch::linkAuthor(uint32_t authorId, int id, long copies)
+{
+    AuthorEntry &e = ownAuthor(authorId);
+    auto ids = e.bookIds ? make_shared<vector<int>>(*e.bookIds) : make_shared<vector<int>>();
+    ids->push_back(id);
+    e.bookIds = move(ids);
+    e.copies += copies;
+}
+
+void Catalog::Batch::unlinkAuthor(uint32_t authorId, int id, long copies)
+{
+    AuthorEntry &e = ownAuthor(authorId);
+    auto ids = make_shared<vector<int>>(*e.bookIds);
+    ids->erase(find(ids->begin(), ids->end(), id));
+    e.bookIds = move(ids);
+    e.copies -= copies;
+}
+
+CatalogChunk *Catalog::Batch::ownRow(int id, int &row)
+{
+    if (!next->findById(id))
+        return nullptr;
+
+    size_t slot = static_cast<size_t>(id) - 1;
+    row = static_cast<int>(slot % CatalogChunk::CAPACITY);
+    return ownChunk(slot / CatalogChunk::CAPACITY);
+}
+
+int Catalog::Batch::append(const string &title, const string &author, int count)
+{
+    if (next->slots % CatalogChunk::CAPACITY == 0)
+    {
+        auto fresh = make_shared<CatalogChunk>();
+        owned.push_back(fresh.get());
+        next->chunks.push_back(move(fresh));
+    }
+
+    int           id = static_cast<int>(++next->slots);
+    CatalogChunk *c  = ownChunk(next->chunks.size() - 1);
+    int           r  = c->used++;
+
+    c->ids[r]       = id;
+    c->counts[r]    = count;
+    c->versions[r]  = 1;
+    c->authorIds[r] = cat.authors.intern(author);
+    c->setTitle(r, title);
+
+    linkAuthor(c->authorIds[r], id, count);
+    return id;
+}
+
+bool Catalog::Batch::update(int id, const string &title, const string &author, int count)
+{
+    int           r;
+    CatalogChunk *c = ownRow(id, r);
+    if (!c)
+        return false;
+
+    uint32_t newAuthor = cat.authors.intern(author);
+    if (newAuthor != c->authorIds[r])
+    {
+        unlinkAuthor(c->authorIds[r], id, c->counts[r]);
+        linkAuthor(newAuthor, id, count);
+    }
+    else
+    {
+        ownAuthor(newAuthor).copies += count - c->counts[r];
+    }
+
+    c->counts[r]    = count;
+    c->authorIds[r] = newAuthor;
+    ++c->versions[r];
+    if (c->title(r) != title)
+        c->setTitle(r, title);
+    return true;
+}
+
+// Compare-and-swap on the row version: applies only if nobody changed the
+// row since the caller read expectedVersion
+Catalog::Batch::EditResult Catalog::Batch::updateIf(int id, uint32_t expectedVersion,
+                                                    const string &title, const string &author, int count)
+{
+    BookRef b = next->findById(id);
+    if (!b)
+        return EditResult::Missing;
+    if (b.version() != expectedVersion)
+        return EditResult::Conflict;
+
+    update(id, title, author, count);
+    return EditResult::Applied;
+}
+
+int Catalog::Batch::adjustCount(int id, int delta)
+{
+    int           r;
+    CatalogChunk *c = ownRow(id, r);
+    if (!c)
+        return -1;
+
+    ownAuthor(c->authorIds[r]).copies += delta;
+    ++c->versions[r];
+    return c->counts[r] += delta;
+}
+
+bool Catalog::Batch::remove(int id)
+{
+    int           r;
+    CatalogChunk *c = ownRow(id, r);
+    if (!c)
+        return false;
+
+    unlinkAuthor(c->authorIds[r], id, c->counts[r]);
+
+    c->ids[r]    = 0;
+    c->counts[r] = 0;
+    ++c->versions[r];
+    c->setTitle(r, "");
+    return true;
+}
+
+void Catalog::Batch::publish()
+{
+    const CatalogVersion *old = cat.current.exchange(next.release(), memory_order_acq_rel);
+    cat.epochs.retire(old);
+}
+
+// Length of the common prefix of a and b, 16 bytes at a time where SSE2 exists
+size_t commonPrefix(string_view a, string_view b)
+{
+    size_t n = min(a.size(), b.size());
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a.data() + i));
+        __m128i y    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b.data() + i));
+        unsigned neq = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFFu;
+        if (neq)
+            return i + static_cast<size_t>(__builtin_ctz(neq));
+    }
+#endif
+    while (i < n && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+// Levenshtein distance. Strips the shared prefix/suffix, then runs Myers'
+// bit-parallel algorithm (64 DP cells per word operation) when the shorter
+// string fits in a machine word, and the plain row DP otherwise.
+int editDistance(string_view a, string_view b)
+{
+    size_t pre = commonPrefix(a, b);
+    a.remove_prefix(pre);
+    b.remove_prefix(pre);
+    while (!a.empty() && !b.empty() && a.back() == b.back())
+    {
+        a.remove_suffix(1);
+        b.remove_suffix(1);
+    }
+
+    if (a.size() > b.size())
+        swap(a, b);
+    if (a.empty())
+        return static_cast<int>(b.size());
+
+    if (a.size() <= 64)
+    {
+        uint64_t peq[256] = {};
+        for (size_t i = 0; i < a.size(); ++i)
+            peq[static_cast<unsigned char>(a[i])] |= uint64_t(1) << i;
+
+        uint64_t pv    = ~uint64_t(0);
+        uint64_t mv    = 0;
+        uint64_t last  = uint64_t(1) << (a.size() - 1);
+        int      score = static_cast<int>(a.size());
+
+        for (char ch : b)
+        {
+            uint64_t eq = peq[static_cast<unsigned char>(ch)];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+
+            if (ph & last)
+                ++score;
+            else if (mh & last)
+                --score;
+
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return score;
+    }
+
+    vector<int> row(a.size() + 1);
+    for (size_t i = 0; i <= a.size(); ++i)
+        row[i] = static_cast<int>(i);
+    for (size_t j = 1; j <= b.size(); ++j)
+    {
+        int diag = row[0];
+        row[0]   = static_cast<int>(j);
+        for (size_t i = 1; i <= a.size(); ++i)
+        {
+            int up = row[i];
+            row[i] = min({row[i] + 1, row[i - 1] + 1, diag + (a[i - 1] != b[j - 1])});
+            diag   = up;
+        }
+    }
+    return row[a.size()];
+}
+
+// Trigram index over normalized titles for typo-tolerant lookups.
+// Postings are sorted book IDs. Edits and removals leave stale postings
+// behind (results are always verified against a catalog snapshot); the
+// index is rebuilt once stale entries outnumber live ones.
+class TitleSearchIndex
+{
+public:
+    struct Match
+    {
+        int id;
+        int distance;
+    };
+
+    static constexpr size_t MAX_RESULTS    = 5;
+    static constexpr size_t MAX_CANDIDATES = 64;
+    static constexpr int    MAX_EDITS      = 3;
+
+    static string normalize(string_view title);
+
+    // Writers: call with the catalog write lock held
+    void add(int id, string_view title);
+    void retire(const CatalogVersion &latest);
+
+    vector<Match> search(string_view query, const CatalogVersion &view);
+
+private:
+    using Postings = unordered_map<uint32_t, vector<int>>;
+
+    static vector<uint32_t> trigrams(const string &norm);
+    static bool             insert(Postings &postings, vector<uint16_t> &lengths, int id, string_view title);
+
+    shared_mutex                             indexMutex;
+    Postings                                 postings;
+    vector<uint16_t>                         lengths;   // normalized title length by ID
+    size_t                                   live  = 0;
+    size_t                                   stale = 0;
+};
+
+// Lower-case letters and digits; any other run of characters becomes one space
+string TitleSearchIndex::normalize(string_view title)
+{
+    string out;
+    out.reserve(title.size());
+    for (char ch : title)
+    {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (isalnum(c))
+            out += static_cast<char>(tolower(c));
+        else if (!out.empty() && out.back() != ' ')
+            out += ' ';
+    }
+    if (!out.empty() && out.back() == ' ')
+        out.pop_back();
+    return out;
+}
+
+// Sorted, de-duplicated trigrams of " norm "
+vector<uint32_t> TitleSearchIndex::trigrams(const string &norm)
+{
+    string padded = " " + norm + " ";
+    vector<uint32_t> grams;
+    for (size_t i = 0; i + 3 <= padded.size(); ++i)
+        grams.push_back((uint32_t(uint8_t(padded[i])) << 16) |
+                        (uint32_t(uint8_t(padded[i + 1])) << 8) |
+                         uint32_t(uint8_t(padded[i + 2])));
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+// Index one title; true if the ID was not indexed before (a rename re-adds it)
+bool TitleSearchIndex::insert(Postings &postings, vector<uint16_t> &lengths, int id, string_view title)
+{
+    string norm  = normalize(title);
+    auto   grams = trigrams(norm);
+
+    if (static_cast<size_t>(id) >= lengths.size())
+        lengths.resize(static_cast<size_t>(id) + 1, 0);
+    bool fresh  = lengths[id] == 0;
+    lengths[id] = static_cast<uint16_t>(min<size_t>(norm.size(), UINT16_MAX));
+
+    for (uint32_t g : grams)
+    {
+        auto &list = postings[g];
+        if (list.empty() || list.back() < id)
+            list.push_back(id);
+        else
+        {
+            auto it = lower_bound(list.begin(), list.end(), id);
+            if (it == list.end() || *it != id)
+                list.insert(it, id);
+        }
+    }
+    return fresh;
+}
+
+void TitleSearchIndex::add(int id, string_view title)
+{
+    unique_lock<shared_mutex> lk(indexMutex);
+    if (insert(postings, lengths, id, title))
+        ++live;
+}
+
+// A title was changed or removed; rebuild from the catalog if needed.
+// The new index is built aside and swapped in, so searches never see it
+// half-built.
+void TitleSearchIndex::retire(const CatalogVersion &latest)
+{
+    {
+        unique_lock<shared_mutex> lk(indexMutex);
+        if (++stale <= live)
+            return;
+    }
+
+    Postings         rebuilt;
+    vector<uint16_t> rebuiltLengths;
+    size_t           rebuiltLive = 0;
+    latest.forEach([&](BookRef b)
+    {
+        if (insert(rebuilt, rebuiltLengths, b.id(), b.title()))
+            ++rebuiltLive;
+    });
+
+    unique_lock<shared_mutex> lk(indexMutex);
+    postings.swap(rebuilt);
+    lengths.swap(rebuiltLengths);
+    live  = rebuiltLive;
+    stale = 0;
+}
+
+// Candidates must share at least |Q| - 3k trigrams with the query for an
+// edit distance of k, so they all appear in one of the rarest
+// |Q| - need + 1 posting lists. Only those lists seed candidates (after a
+// length filter); the longer lists are merely probed for them.
+vector<TitleSearchIndex::Match> TitleSearchIndex::search(string_view query, const CatalogVersion &view)
+{
+    string norm     = normalize(query);
+    auto   grams    = trigrams(norm);
+    int    maxEdits = min(MAX_EDITS, max(1, static_cast<int>(norm.size()) / 8));
+    size_t need     = grams.size() > size_t(3 * maxEdits) ? grams.size() - 3 * maxEdits : 1;
+
+    vector<pair<int, int>> scored;   // (shared trigrams, id)
+    {
+        shared_lock<shared_mutex> lk(indexMutex);
+
+        vector<const vector<int> *> lists;
+        for (uint32_t g : grams)
+        {
+            auto it = postings.find(g);
+            if (it != postings.end())
+                lists.push_back(&it->second);
+        }
+        if (lists.size() < need)
+            return {};
+
+        sort(lists.begin(), lists.end(),
+             [](const vector<int> *x, const vector<int> *y) { return x->size() < y->size(); });
+
+        // Dense per-thread hit counters; only touched entries are reset
+        thread_local vector<uint16_t> hits;
+        vector<int>                   touched;
+
+        size_t seedLists = lists.size() - need + 1;
+        for (size_t i = 0; i < seedLists; ++i)
+        {
+            for (int id : *lists[i])
+            {
+                // Titles whose length differs by more than maxEdits can't match
+                if (abs(static_cast<int>(lengths[id]) - static_cast<int>(norm.size())) > maxEdits)
+                    continue;
+                if (static_cast<size_t>(id) >= hits.size())
+                    hits.resize(static_cast<size_t>(id) + 1, 0);
+                if (hits[id]++ == 0)
+                    touched.push_back(id);
+            }
+        }
+
+        // Probe each longer list with whichever is cheaper: binary search
+        // per candidate or one linear pass over the list
+        for (size_t i = seedLists; i < lists.size(); ++i)
+        {
+            const vector<int> &list = *lists[i];
+            if (touched.size() * 16 < list.size())
+            {
+                for (int id : touched)
+                    if (binary_search(list.begin(), list.end(), id))
+                        ++hits[id];
+            }
+            else
+            {
+                for (int id : list)
+                    if (static_cast<size_t>(id) < hits.size() && hits[id] != 0)
+                        ++hits[id];
+            }
+        }
+
+        for (int id : touched)
+        {
+            if (hits[id] >= need)
+                scored.push_back({hits[id], id});
+            hits[id] = 0;
+        }
+    }
+
+    size_t keep = min(scored.size(), MAX_CANDIDATES);
+    partial_sort(scored.begin(), scored.begin() + keep, scored.end(), greater<>());
+    scored.resize(keep);
+
+    vector<Match> matches;
+    for (auto &c : scored)
+    {
+        BookRef b = view.findById(c.second);
+        if (!b)
+            continue;
+        int d = editDistance(norm, normalize(b.title()));
+        if (d <= maxEdits)
+            matches.push_back({c.second, d});
+    }
+
+    stable_sort(matches.begin(), matches.end(),
+                [](const Match &x, const Match &y) { return x.distance < y.distance; });
+    if (matches.size() > MAX_RESULTS)
+        matches.resize(MAX_RESULTS);
+    return matches;
+}
+
+// Operations captured by the audit log
+enum class AuditOp : uint8_t
+{
+    Register, Login, LoginFailed, Logout,
+    AddBook, UpdateBook, RemoveBook,
+    Borrow, BorrowWait, Return, ReturnRejected,
+    AddBranch, Transfer,
+    HoldFilled, HoldExpired, HoldCancelled
+};
+
+inline const char *auditOpName(AuditOp op)
+{
+    static const char *names[] = {
+        "register", "login", "login-failed", "logout",
+        "add-book", "update-book", "remove-book",
+        "borrow", "borrow-wait", "return", "return-rejected",
+        "add-branch", "transfer",
+        "hold-filled", "hold-expired", "hold-cancelled"
+    };
+    return names[static_cast<int>(op)];
+}
+
+// One fixed-size binary audit record (24 bytes)
+struct AuditEvent
+{
+    uint64_t timeNs;      // system_clock, nanoseconds since the epoch
+    int32_t  accountId;
+    int32_t  bookKey;     // branch-qualified book key, 0 if none
+    int32_t  value;       // copies remaining / moved / set, op-specific
+    uint16_t branch;      // destination branch for transfers
+    AuditOp  op;
+    uint8_t  reserved;
+};
+
+// Audit trail for every Library operation. record() pushes into a
+// bounded lock-free ring (Vyukov MPMC cells) and never blocks: when the
+// ring is full the event is counted as dropped. A background drainer
+// (ticking every 100 ms, woken early whenever another half ring fills)
+// appends events to a size-rotated binary file and keeps the most recent
+// ones in memory for tail(). An empty path is a null sink: record() does
+// nothing and no drainer is started.
+class AuditLog
+{
+public:
+    static constexpr size_t CAPACITY   = 1 << 14;   // must be a power of two
+    static constexpr size_t TAIL_SIZE  = 256;
+    static constexpr long   MAX_BYTES  = 1 << 20;   // rotate after 1 MiB
+    static constexpr int    KEEP_FILES = 3;
+
+    explicit AuditLog(const string &path);
+    ~AuditLog();
+
+    void record(AuditOp op, int accountId, int bookKey = 0, int value = 0, int branch = 0);
+
+    vector<AuditEvent> tail(size_t n);
+    uint64_t           dropped() const { return droppedCount.load(memory_order_relaxed); }
+
+private:
+    struct alignas(64) Cell
+    {
+        atomic<size_t> seq;
+        AuditEvent     event;
+    };
+
+    bool pop(AuditEvent &e);
+    void drain();
+    void run();
+    void rotate();
+
+    unique_ptr<Cell[]>    cells;
+    alignas(64) atomic<size_t> head{0};   // next slot to claim
+    alignas(64) size_t         tailPos = 0;   // consumer position (drainMutex)
+    atomic<uint64_t>      droppedCount{0};
+
+    string                path;
+    bool                  enabled;
+    ofstream              out;
+    long                  written = 0;
+
+    mutex                 drainMutex;
+    deque<AuditEvent>     recent;
+
+    mutex                 wakeMutex;
+    condition_variable    wakeCv;
+    bool                  stopping = false;
+    thread                drainer;
+};
+
+AuditLog::AuditLog(const string &p)
+    : cells(new Cell[CAPACITY]), path(p), enabled(!p.empty())
+{
+    for (size_t i = 0; i < CAPACITY; ++i)
+        cells[i].seq.store(i, memory_order_relaxed);
+
+    if (!enabled)
+        return;
+
+    out.open(path, ios::binary | ios::app);
+    out.seekp(0, ios::end);
+    written = out ? static_cast<long>(out.tellp()) : 0;
+
+    drainer = thread(&AuditLog::run, this);
+}
+
+AuditLog::~AuditLog()
+{
+    if (!enabled)
+        return;
+    {
+        lock_guard<mutex> lk(wakeMutex);
+        stopping = true;
+    }
+    wakeCv.notify_one();
+    drainer.join();
+    drain();
+}
+
+// Hot path: one CAS to claim a cell, a copy, one release store
+void AuditLog::record(AuditOp op, int accountId, int bookKey, int value, int branch)
+{
+    if (!enabled)
+        return;
+
+    AuditEvent e;
+    e.timeNs    = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+                      chrono::system_clock::now().time_since_epoch()).count());
+    e.accountId = accountId;
+    e.bookKey   = bookKey;
+    e.value     = value;
+    e.branch    = static_cast<uint16_t>(branch);
+    e.op        = op;
+    e.reserved  = 0;
+
+    size_t pos = head.load(memory_order_relaxed);
+    while (true)
+    {
+        Cell     &c   = cells[pos & (CAPACITY - 1)];
+        size_t    seq = c.seq.load(memory_order_acquire);
+        ptrdiff_t dif = static_cast<ptrdiff_t>(seq) - static_cast<ptrdiff_t>(pos);
+
+        if (dif == 0)
+        {
+            if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+            {
+                c.event = e;
+                c.seq.store(pos + 1, memory_order_release);
+
+                // Wake the drainer early every half ring instead of waiting for its tick
+                if ((pos & (CAPACITY / 2 - 1)) == 0)
+                    wakeCv.notify_one();
+                return;
+            }
+        }
+        else if (dif < 0)
+        {
+            droppedCount.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = head.load(memory_order_relaxed);
+        }
+    }
+}
+
+// Consumer side; callers hold drainMutex
+bool AuditLog::pop(AuditEvent &e)
+{
+    Cell  &c   = cells[tailPos & (CAPACITY - 1)];
+    size_t seq = c.seq.load(memory_order_acquire);
+    if (seq != tailPos + 1)
+        return false;
+
+    e = c.event;
+    c.seq.store(tailPos + CAPACITY, memory_order_release);
+    ++tailPos;
+    return true;
+}
+
+void AuditLog::drain()
+{
+    lock_guard<mutex> lk(drainMutex);
+
+    AuditEvent e;
+    while (pop(e))
+    {
+        if (out)
+        {
+            out.write(reinterpret_cast<const char *>(&e), sizeof e);
+            written += static_cast<long>(sizeof e);
+            if (written >= MAX_BYTES)
+                rotate();
+        }
+
+        recent.push_back(e);
+        if (recent.size() > TAIL_SIZE)
+            recent.pop_front();
+    }
+    out.flush();
+}
+
+// path -> path.1 -> path.2 ...; the oldest file is discarded
+void AuditLog::rotate()
+{
+    out.close();
+    for (int i = KEEP_FILES - 1; i >= 1; --i)
+    {
+        string from = i == 1 ? path : path + "." + to_string(i - 1);
+        std::rename(from.c_str(), (path + "." + to_string(i)).c_str());
+    }
+    out.open(path, ios::binary | ios::trunc);
+    written = 0;
+}
+
+void AuditLog::run()
+{
+    TRACE_THREAD_NAME("audit drainer");
+    unique_lock<mutex> lk(wakeMutex);
+    while (!stopping)
+    {
+        wakeCv.wait_for(lk, chrono::milliseconds(100));
+        lk.unlock();
+        drain();
+        lk.lock();
+    }
+}
+
+// Most recent events, oldest first
+vector<AuditEvent> AuditLog::tail(size_t n)
+{
+    drain();
+
+    lock_guard<mutex> lk(drainMutex);
+    n = min(n, recent.size());
+    return vector<AuditEvent>(recent.end() - static_cast<ptrdiff_t>(n), recent.end());
+}
+
+// Outcome of a borrow request; Queued means a hold is still pending
+enum class BorrowResult : uint8_t { Borrowed, Queued, NotFound, Busy, OutOfStock, TimedOut, Cancelled };
+
+enum class ReturnResult : uint8_t { Returned, NotBorrowed, NotFound };
+
+// Set once when the session that owns it logs out
+struct CancelToken
+{
+    atomic<bool> cancelled{false};
+};
+
+// A parked borrow request. Nothing waits on it: a return hands the copy
+// over directly, and the HoldQueue reaper expires it at its deadline.
+struct BorrowHold
+{
+    uint64_t                          ticket;
+    int                               accountIdx;
+    int                               bookKey;
+    chrono::steady_clock::time_point  deadline;
+    shared_ptr<CancelToken>           token;
+    atomic<BorrowResult>              state{BorrowResult::Queued};
+    bool                              reported = false;   // guarded by HoldQueue::holdsMutex
+};
+
+// FIFO holds per book plus one reaper thread for all deadlines, so a
+// parked borrow costs a heap entry rather than a blocked thread
+class HoldQueue
+{
+public:
+    using Hold = shared_ptr<BorrowHold>;
+
+    static constexpr int MAX_MINUTES = 7 * 24 * 60;   // longest hold a patron can ask for
+
+    HoldQueue();
+    ~HoldQueue();
+
+    Hold place(int accountIdx, int bookKey, chrono::steady_clock::time_point deadline,
+               shared_ptr<CancelToken> token);
+    Hold claimNext(int bookKey);                 // next live hold, already marked Borrowed
+    vector<Hold> cancelAll(int accountIdx);      // session logout; returns the holds it cancelled
+    vector<Hold> pending(int accountIdx);
+    vector<Hold> takeFinished(int accountIdx);   // finished holds not yet shown to the user
+    void markReported(const Hold &h);            // the caller already told the user
+
+    function<void(const BorrowHold &)> onExpired;
+
+private:
+    struct Deadline
+    {
+        chrono::steady_clock::time_point when;
+        weak_ptr<BorrowHold>             hold;
+        bool operator>(const Deadline &o) const { return when > o.when; }
+    };
+
+    void run();
+    void dropFromBook(const Hold &h);
+
+    mutex                                   holdsMutex;
+    condition_variable                      reaperCv;
+    uint64_t                                nextTicket = 0;
+    unordered_map<int, deque<Hold>>         byBook;
+    unordered_map<int, vector<Hold>>        byAccount;
+    priority_queue<Deadline, vector<Deadline>, greater<>> deadlines;
+    bool                                    stopping = false;
+    metrics::Gauge                         &deadlineDepth = metrics::gauge("hold_deadlines", "Holds in the reaper's deadline queue");
+    thread                                  reaper;
+};
+
+HoldQueue::HoldQueue()
+    : reaper(&HoldQueue::run, this)
+{
+}
+
+HoldQueue::~HoldQueue()
+{
+    {
+        lock_guard<mutex> lk(holdsMutex);
+        stopping = true;
+    }
+    reaperCv.notify_one();
+    reaper.join();
+}
+
+HoldQueue::Hold HoldQueue::place(int accountIdx, int bookKey, chrono::steady_clock::time_point deadline,
+                                 shared_ptr<CancelToken> token)
+{
+    auto h = make_shared<BorrowHold>();
+    h->accountIdx = accountIdx;
+    h->bookKey    = bookKey;
+    h->deadline   = deadline;
+    h->token      = move(token);
+
+    bool earliest;
+    {
+        lock_guard<mutex> lk(holdsMutex);
+        h->ticket = ++nextTicket;
+        byBook[bookKey].push_back(h);
+        byAccount[accountIdx].push_back(h);
+        earliest = deadlines.empty() || deadline < deadlines.top().when;
+        deadlines.push({deadline, h});
+        deadlineDepth.set(deadlines.size());
+    }
+    if (earliest)
+        reaperCv.notify_one();
+    return h;
+}
+
+// Skips holds that expired, were cancelled or belong to a closed session
+HoldQueue::Hold HoldQueue::claimNext(int bookKey)
+{
+    lock_guard<mutex> lk(holdsMutex);
+    auto it = byBook.find(bookKey);
+    if (it == byBook.end())
+        return nullptr;
+
+    auto &q   = it->second;
+    auto  now = chrono::steady_clock::now();
+    while (!q.empty())
+    {
+        Hold h = move(q.front());
+        q.pop_front();
+
+        BorrowResult expected = BorrowResult::Queued;
+        if (h->token->cancelled.load())
+            h->state.compare_exchange_strong(expected, BorrowResult::Cancelled);
+        else if (h->deadline <= now)
+            h->state.compare_exchange_strong(expected, BorrowResult::TimedOut);
+        else if (h->state.compare_exchange_strong(expected, BorrowResult::Borrowed))
+            return h;
+    }
+    byBook.erase(it);
+    return nullptr;
+}
+
+// Every hold of the account is finished afterwards, so its entry is
+// dropped: sessions that never call takeFinished don't accumulate holds
+vector<HoldQueue::Hold> HoldQueue::cancelAll(int accountIdx)
+{
+    vector<Hold> cancelled;
+    lock_guard<mutex> lk(holdsMutex);
+    auto it = byAccount.find(accountIdx);
+    if (it == byAccount.end())
+        return cancelled;
+
+    for (auto &h : it->second)
+    {
+        BorrowResult expected = BorrowResult::Queued;
+        if (h->state.compare_exchange_strong(expected, BorrowResult::Cancelled))
+        {
+            dropFromBook(h);
+            cancelled.push_back(h);
+        }
+    }
+    byAccount.erase(it);
+    return cancelled;
+}
+
+vector<HoldQueue::Hold> HoldQueue::pending(int accountIdx)
+{
+    vector<Hold> result;
+    lock_guard<mutex> lk(holdsMutex);
+    for (auto &h : byAccount[accountIdx])
+        if (h->state.load() == BorrowResult::Queued)
+            result.push_back(h);
+    return result;
+}
+
+vector<HoldQueue::Hold> HoldQueue::takeFinished(int accountIdx)
+{
+    vector<Hold> result;
+    lock_guard<mutex> lk(holdsMutex);
+    auto &mine = byAccount[accountIdx];
+    for (auto &h : mine)
+        if (h->state.load() != BorrowResult::Queued && !h->reported)
+            result.push_back(h);
+    mine.erase(remove_if(mine.begin(), mine.end(),
+                         [](const Hold &h) { return h->state.load() != BorrowResult::Queued; }),
+               mine.end());
+    return result;
+}
+
+void HoldQueue::markReported(const Hold &h)
+{
+    lock_guard<mutex> lk(holdsMutex);
+    h->reported = true;
+}
+
+// A hold that can no longer be filled leaves its book's queue, so titles
+// nobody returns don't collect dead holds (holdsMutex held)
+void HoldQueue::dropFromBook(const Hold &h)
+{
+    auto it = byBook.find(h->bookKey);
+    if (it == byBook.end())
+        return;
+
+    auto &q = it->second;
+    q.erase(remove(q.begin(), q.end(), h), q.end());
+    if (q.empty())
+        byBook.erase(it);
+}
+
+// Sleeps until the earliest deadline and drops expired holds from their
+// book queue; claimNext still skips any that expire in between
+void HoldQueue::run()
+{
+    TRACE_THREAD_NAME("hold reaper");
+    unique_lock<mutex> lk(holdsMutex);
+    while (!stopping)
+    {
+        if (deadlines.empty())
+        {
+            reaperCv.wait(lk);
+            continue;
+        }
+
+        auto when = deadlines.top().when;
+        if (chrono::steady_clock::now() < when)
+        {
+            reaperCv.wait_until(lk, when);
+            continue;
+        }
+
+        Hold h = deadlines.top().hold.lock();
+        deadlines.pop();
+        deadlineDepth.set(deadlines.size());
+
+        BorrowResult expected = BorrowResult::Queued;
+        if (h && h->state.compare_exchange_strong(expected, BorrowResult::TimedOut))
+        {
+            dropFromBook(h);
+            if (onExpired)
+            {
+                lk.unlock();
+                onExpired(*h);
+                lk.lock();
+            }
+        }
+    }
+}
+
+// User account record
+struct Account
+{
+    string        username;
+    string        firstName;
+    string        middleName;
+    string        lastName;
+    string        password;
+    int           id;
+    bool          loggedIn;
+    bool          isAdmin;
+
+    // NEW: which book IDs this user currently has borrowed
+    // (branch-qualified keys, see makeBookKey)
+    vector<int>   borrowedBookIds;
+
+    // branch this account is currently working at
+    int           branch = 0;
+
+    // cancelled at logout, which also cancels the session's pending holds
+    shared_ptr<CancelToken> session{};
+};
+
+// Book IDs are per branch; accounts and statistics use branch-qualified keys
+constexpr int BRANCH_KEY_SPAN = 1 << 24;
+
+inline int makeBookKey(int branch, int bookId) { return branch * BRANCH_KEY_SPAN + bookId; }
+inline int keyBranch(int key)                  { return key / BRANCH_KEY_SPAN; }
+inline int keyBookId(int key)                  { return key % BRANCH_KEY_SPAN; }
+
+// One library branch: its own catalog, writer lock and indexes, so
+// branch-local traffic never touches another branch's state
+struct Branch
+{
+    explicit Branch(const string &n) : name(n) {}
+
+    string             name;
+    Catalog            catalog;
+    RWLock             booksLock;      // serializes this branch's catalog writers
+    TitleSearchIndex   titleIndex;
+};
+
+// Main library class
+class Library
+{
+public:
+    explicit Library(const string &auditPath);   // "" = no audit trail
+    void registerUser();
+    int  loginUser();
+    void userSession(int idx);
+    int  replay(const string &path, bool paced);
+
+    static int simulate(int schedules, uint64_t firstSeed, bool trace);
+
+private:
+    void listAllBooks();
+    void addBook();
+    void updateBook();
+    void removeBook();
+    void borrowBook();
+    void returnBook();
+    void checkAvailability();
+    void recommendBooks();
+    void listBooksByAuthor();
+    void suggestTitles(const string &title);
+    void displayLockStatus();
+    void detectDeadlocks();
+    void ensureFairness();
+    void displayBorrowStats();
+    void addBranch();
+    void switchBranch();
+    void transferCopies();
+    void checkAllBranches();
+    void displayAuditTail();
+    void listHolds();
+    void reportFinishedHolds(int idx);
+    void serveHolds(int branchIdx, int bookId);
+    void endSession(int idx);
+
+    // Core operations shared by the menus and replay; no console I/O
+    int             createAccount(const string &first, const string &middle,
+                                  const string &last, const string &pwd);
+    int             authenticate(const string &uname, const string &pwd);
+    int             addTitle(int uid, const string &title, const string &author, int qty);
+    bool            removeTitle(int uid, const string &title);
+    BorrowResult    borrowCopy(int uid, const string &title, int &remaining);
+    HoldQueue::Hold placeHold(int uid, const string &title, int minutes);
+    ReturnResult    returnCopy(int uid, const string &title, int &now);
+    int             availableCopies(int uid, const string &title);
+    int             openBranch(int uid, const string &name);
+    bool            selectBranch(int uid, const string &name);
+
+    bool    validPassword(const string &pwd);
+    Branch &currentBranch();
+    int     findBranch(const string &name);
+    string  describeKey(int key);
+
+    static constexpr int MAX_BRANCHES = 64;
+
+    // Branches are only ever appended; readers index up to branchCount
+    unique_ptr<Branch> branches[MAX_BRANCHES];
+    atomic<int>        branchCount{0};
+    mutex              branchMutex;
+
+    // Odd while a transfer is publishing; cross-branch reads retry on change
+    atomic<uint64_t>   transferSeq{0};
+
+    vector<Account> accounts;
+
+    // track which account is currently active
+    int             currentUserIdx = -1;
+
+    // Acquisitions statistics fed from borrowBook
+    static constexpr size_t TOP_K = 10;
+    HeavyHitters    topBorrowed{TOP_K};
+    HeavyHitters    topOutOfStock{TOP_K};
+
+    CoBorrowIndex   coBorrows;
+
+    AuditLog        audit;
+
+    HoldQueue       holds;
+
+    // guards every account's borrowedBookIds: holds are filled from other sessions
+    TRACE_LOCKABLE_ARGS(metrics::Metered<sim::Mutex>, loansMutex, "loansMutex");
+
+    TRACE_LOCKABLE_ARGS(metrics::Metered<mutex>, accountMutex, "accountMutex");
+
+    metrics::Gauge     &accountCount = metrics::gauge("accounts", "Registered accounts");
+    metrics::Operation  createAccountOp{"createAccount"};
+    metrics::Operation  authenticateOp{"authenticate"};
+    metrics::Operation  addTitleOp{"addTitle"};
+    metrics::Operation  removeTitleOp{"removeTitle"};
+    metrics::Operation  borrowOp{"borrowCopy"};
+    metrics::Operation  placeHoldOp{"placeHold"};
+    metrics::Operation  returnOp{"returnCopy"};
+    metrics::Operation  availableOp{"availableCopies"};
+};
+
+// Default admin account information
+Library::Library(const string &auditPath)
+    : audit(auditPath)
+{
+    accounts.push_back({
+        "admin",
+        "Administrator",
+        "",
+        "",
+        "password",
+        1,
+        false,
+        true,
+        {}              // borrowedBookIds empty
+    });
+
+    branches[0] = make_unique<Branch>("Main");
+    branchCount.store(1, memory_order_release);
+
+    holds.onExpired = [this](const BorrowHold &h)
+    {
+        audit.record(AuditOp::HoldExpired, accounts[h.accountIdx].id, h.bookKey);
+    };
+}
+
+// Branch the active account is working at
+Branch &Library::currentBranch()
+{
+    return *branches[accounts[currentUserIdx].branch];
+}
+
+int Library::findBranch(const string &name)
+{
+    int n = branchCount.load(memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+        if (branches[i]->name == name)
+            return i;
+    return -1;
+}
+
+// "Title by Author @ Branch" for a branch-qualified book key
+string Library::describeKey(int key)
+{
+    Branch           &br = *branches[keyBranch(key)];
+    Catalog::ReadView view(br.catalog);
+    BookRef           b = view->findById(keyBookId(key));
+    if (!b)
+        return "(removed)";
+    return string(b.title()) + " by " + b.author() + " @ " + br.name;
+}
+
+// Password strength check
+bool Library::validPassword(const string &pwd)
+{
+    if (pwd.size() < 8) return false;
+
+    bool upper   = false;
+    bool lower   = false;
+    bool digit   = false;
+    bool special = false;
+
+    for (char c : pwd)
+    {
+        upper   |= isupper((unsigned char)c);
+        lower   |= islower((unsigned char)c);
+        digit   |= isdigit((unsigned char)c);
+        special |= ispunct((unsigned char)c);
+    }
+
+    return upper && lower && digit && special;
+}
+
+// Register a new user
+void Library::registerUser()
+{
+    lock_guard lk(accountMutex);
+
+    string first, middle, last, pwd, confirm;
+    {
+        lock_guard io(io_mutex);
+        cout << "First Name: " << flush;
+    }
+    getline(cin, first);
+
+    {
+        lock_guard io(io_mutex);
+        cout << "Middle Name: " << flush;
+    }
+    getline(cin, middle);
+
+    {
+        lock_guard io(io_mutex);
+        cout << "Last Name: " << flush;
+    }
+    getline(cin, last);
+
+    string uname = first.substr(0,1) + middle.substr(0,1) + last;
+    {
+        lock_guard io(io_mutex);
+        cout << "Your username: " << uname << '\n' << flush;
+    }
+
+    while (true)
+    {
+        {
+            lock_guard io(io_mutex);
+            cout << "Password (Minimum of 8 chars, must include upper/lower/digit/special): " << flush;
+        }
+        getline(cin, pwd);
+
+        if (!validPassword(pwd))
+        {
+            lock_guard io(io_mutex);
+            cout << "Weak password.\n" << flush;
+            continue;
+        }
+
+        {
+            lock_guard io(io_mutex);
+            cout << "Confirm password: " << flush;
+        }
+        getline(cin, confirm);
+
+        if (pwd != confirm)
+        {
+            lock_guard io(io_mutex);
+            cout << "Passwords do not match.\n" << flush;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    int idx = createAccount(first, middle, last, pwd);
+
+    {
+        lock_guard io(io_mutex);
+        cout << "User registered with ID: " << accounts[idx].id << '\n' << flush;
+    }
+}
+
+// Append an account; caller holds accountMutex and has checked the password
+int Library::createAccount(const string &first, const string &middle,
+                           const string &last, const string &pwd)
+{
+    TRACE_SPAN("createAccount");
+    metrics::Operation::Scope metered(createAccountOp);
+    accounts.push_back({
+        first.substr(0,1) + middle.substr(0,1) + last,
+        first,
+        middle,
+        last,
+        pwd,
+        static_cast<int>(accounts.size()) + 1,
+        false,
+        false,
+        {}   // start with no borrowed books
+    });
+
+    audit.record(AuditOp::Register, accounts.back().id);
+    accountCount.set(accounts.size());
+    return static_cast<int>(accounts.size()) - 1;
+}
+
+// Login user
+int Library::loginUser()
+{
+    string uname, pwd;
+
+    {
+        lock_guard io(io_mutex);
+        cout << "Username: " << flush;
+    }
+    getline(cin, uname);
+
+    {
+        lock_guard io(io_mutex);
+        cout << "Password: " << flush;
+    }
+    getline(cin, pwd);
+
+    int idx = authenticate(uname, pwd);
+
+    lock_guard io(io_mutex);
+    if (idx >= 0)
+        cout << "Welcome, " << accounts[idx].firstName << "!\n" << flush;
+    else
+        cout << "Invalid credentials.\n" << flush;
+    return idx;
+}
+
+// Start a session for matching credentials; account index or -1
+int Library::authenticate(const string &uname, const string &pwd)
+{
+    TRACE_SPAN("authenticate");
+    metrics::Operation::Scope metered(authenticateOp);
+    lock_guard lk(accountMutex);
+    for (auto &acct : accounts)
+    {
+        // One session per account: its session token and branch are then
+        // only ever written by that session's thread
+        if (acct.username == uname && acct.password == pwd && !acct.loggedIn)
+        {
+            acct.loggedIn = true;
+            acct.session  = make_shared<CancelToken>();
+            audit.record(AuditOp::Login, acct.id);
+            return acct.id - 1;
+        }
+    }
+
+    audit.record(AuditOp::LoginFailed, 0);
+    metered.error();
+    return -1;
+}
+
+// List all books
+void Library::listAllBooks()
+{
+    TRACE_SPAN("listAllBooks");
+    lock_guard io(io_mutex);
+    Branch &br = currentBranch();
+    Catalog::ReadView view(br.catalog);
+
+    bool any = false;
+    view->forEach([&](BookRef) { any = true; });
+
+    if (!any)
+    {
+        cout << "No books in the library.\n";
+    }
+    else
+    {
+        constexpr int ID_W = 4, T_W = 40, A_W = 30, C_W = 6;
+        cout << br.name << " branch, catalog version " << view->version << "\n";
+        cout << left
+             << setw(ID_W) << "ID"
+             << setw(T_W) << "Title"
+             << setw(A_W) << "Author"
+             << setw(C_W) << "Count" << "\n";
+        cout << string(ID_W + T_W + A_W + C_W, '-') << "\n";
+
+        view->forEach([&](BookRef b)
+        {
+            cout << left
+                 << setw(ID_W) << b.id()
+                 << setw(T_W) << b.title()
+                 << setw(A_W) << b.author()
+                 << setw(C_W) << b.count() << "\n";
+        });
+    }
+}
+
+// Add book
+void Library::addBook()
+{
+    lock_guard io(io_mutex);
+
+    cout << "Book title: " << flush;
+    string t; getline(cin, t);
+
+    cout << "Author: " << flush;
+    string a; getline(cin, a);
+
+    cout << "Quantity: " << flush;
+    int c; cin >> c;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+    addTitle(currentUserIdx, t, a, c);
+    cout << "Added '" << t << "'.\n" << flush;
+}
+
+int Library::addTitle(int uid, const string &title, const string &author, int qty)
+{
+    TRACE_SPAN("addTitle");
+    metrics::Operation::Scope metered(addTitleOp);
+    int     branchIdx = accounts[uid].branch;
+    Branch &br        = *branches[branchIdx];
+
+    br.booksLock.lockWrite();
+    Catalog::Batch batch(br.catalog);
+    int id = batch.append(title, author, qty);
+    batch.publish();
+    br.titleIndex.add(id, title);
+    br.booksLock.unlockWrite();
+
+    audit.record(AuditOp::AddBook, accounts[uid].id, makeBookKey(branchIdx, id), qty);
+    return id;
+}
+
+// Update book. Optimistic: the row and its version are read from a
+// snapshot, the new values are entered with no lock held, and the write
+// is a compare-and-swap on the version. A conflicting edit is reported and
+// the admin retries against the current values.
+void Library::updateBook()
+{
+    Branch &br = currentBranch();
+
+    {
+        lock_guard io(io_mutex);
+        cout << "Title to update: " << flush;
+    }
+    string t; getline(cin, t);
+
+    int id = 0;
+    while (true)
+    {
+        Book     changed;
+        uint32_t seen;
+        {
+            Catalog::ReadView view(br.catalog);
+            BookRef           b = id ? view->findById(id) : view->findByTitle(t);
+            if (!b)
+            {
+                lock_guard io(io_mutex);
+                cout << (id ? "Book was removed meanwhile.\n" : "Book not found.\n") << flush;
+                return;
+            }
+            id      = b.id();
+            seen    = b.version();
+            changed = {string(b.title()), b.author(), b.count(), id};
+        }
+
+        string oldTitle = changed.title;
+        {
+            lock_guard io(io_mutex);
+            cout << "Current: '" << changed.title << "' by " << changed.author
+                 << ", qty " << changed.count << "\n";
+            cout << "New title: " << flush;
+        }
+        getline(cin, changed.title);
+        {
+            lock_guard io(io_mutex);
+            cout << "New author: " << flush;
+        }
+        getline(cin, changed.author);
+        {
+            lock_guard io(io_mutex);
+            cout << "New qty: " << flush;
+        }
+        cin >> changed.count;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+        br.booksLock.lockWrite();
+        Catalog::Batch batch(br.catalog);
+        auto result = batch.updateIf(id, seen, changed.title, changed.author, changed.count);
+        if (result == Catalog::Batch::EditResult::Applied)
+        {
+            batch.publish();
+            if (changed.title != oldTitle)
+            {
+                br.titleIndex.add(id, changed.title);
+                br.titleIndex.retire(br.catalog.latest());
+            }
+            serveHolds(accounts[currentUserIdx].branch, id);
+        }
+        br.booksLock.unlockWrite();
+
+        lock_guard io(io_mutex);
+        if (result == Catalog::Batch::EditResult::Applied)
+        {
+            audit.record(AuditOp::UpdateBook, accounts[currentUserIdx].id,
+                         makeBookKey(accounts[currentUserIdx].branch, id), changed.count);
+            cout << "Book updated.\n" << flush;
+            return;
+        }
+        if (result == Catalog::Batch::EditResult::Missing)
+        {
+            cout << "Book was removed meanwhile.\n" << flush;
+            return;
+        }
+        cout << "Someone else changed this book while you were editing. Please re-enter.\n" << flush;
+    }
+}
+
+// Remove book
+void Library::removeBook()
+{
+    lock_guard io(io_mutex);
+
+    cout << "Title to remove: " << flush;
+    string t; getline(cin, t);
+
+    if (!removeTitle(currentUserIdx, t))
+    {
+        cout << "Book not found.\n";
+        suggestTitles(t);
+        return;
+    }
+
+    cout << "Book removed.\n" << flush;
+}
+
+bool Library::removeTitle(int uid, const string &title)
+{
+    TRACE_SPAN("removeTitle");
+    metrics::Operation::Scope metered(removeTitleOp);
+    int     branchIdx = accounts[uid].branch;
+    Branch &br        = *branches[branchIdx];
+
+    br.booksLock.lockWrite();
+    BookRef b = br.catalog.latest().findByTitle(title);
+    if (!b)
+    {
+        br.booksLock.unlockWrite();
+        metered.error();
+        return false;
+    }
+
+    int removedId = b.id();
+
+    Catalog::Batch batch(br.catalog);
+    batch.remove(removedId);
+    batch.publish();
+    br.titleIndex.retire(br.catalog.latest());
+    br.booksLock.unlockWrite();
+
+    audit.record(AuditOp::RemoveBook, accounts[uid].id, makeBookKey(branchIdx, removedId));
+    return true;
+}
+
+// Borrow book. An out-of-stock title gets a hold with a deadline instead
+// of a blocked session; returns fill holds in FIFO order.
+void Library::borrowBook()
+{
+    lock_guard io(io_mutex);
+
+    // remember who’s borrowing
+    int uid = currentUserIdx;
+
+    cout << "Title to borrow: " << flush;
+    string t; getline(cin, t);
+
+    int remaining = 0;
+    switch (borrowCopy(uid, t, remaining))
+    {
+        case BorrowResult::Borrowed:
+            cout << "Borrowed '" << t << "'. Remaining: " << remaining << "\n" << flush;
+            return;
+        case BorrowResult::Busy:
+            cout << "Library busy. Try later.\n" << flush;
+            return;
+        case BorrowResult::NotFound:
+            cout << "Book not found.\n";
+            suggestTitles(t);
+            return;
+        default:
+            break;
+    }
+
+    cout << "Out of stock. Hold for how many minutes (0 = no hold, at most "
+         << HoldQueue::MAX_MINUTES << ")? " << flush;
+    int minutes = 0;
+    cin >> minutes;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (minutes <= 0)
+    {
+        cout << "No hold placed.\n" << flush;
+        return;
+    }
+
+    auto hold = placeHold(uid, t, minutes);
+    if (!hold)
+        cout << "Book not found.\n" << flush;
+    else if (hold->state.load() == BorrowResult::Borrowed)
+        cout << "A copy just came back: borrowed '" << t << "'.\n" << flush;
+    else
+        cout << "Hold #" << hold->ticket << " placed; it is filled automatically when a copy is returned.\n"
+             << flush;
+}
+
+BorrowResult Library::borrowCopy(int uid, const string &title, int &remaining)
+{
+    TRACE_SPAN("borrowCopy");
+    metrics::Operation::Scope metered(borrowOp);
+    int     branchIdx = accounts[uid].branch;
+    Branch &br        = *branches[branchIdx];
+
+    if (!br.booksLock.tryLockWrite())
+    {
+        metered.busy();
+        return BorrowResult::Busy;
+    }
+
+    BookRef b = br.catalog.latest().findByTitle(title);
+    if (!b)
+    {
+        br.booksLock.unlockWrite();
+        metered.error();
+        return BorrowResult::NotFound;
+    }
+
+    int bookId = b.id();
+    int key    = makeBookKey(branchIdx, bookId);
+
+    if (b.count() == 0)
+    {
+        br.booksLock.unlockWrite();
+        topOutOfStock.record(key);
+        metered.error();
+        return BorrowResult::OutOfStock;
+    }
+
+    Catalog::Batch batch(br.catalog);
+    remaining = batch.adjustCount(bookId, -1);
+    batch.publish();
+    br.booksLock.unlockWrite();
+
+    topBorrowed.record(key);
+    {
+        // record it on the user’s account
+        lock_guard loans(loansMutex);
+        coBorrows.submit(key, accounts[uid].borrowedBookIds);
+        accounts[uid].borrowedBookIds.push_back(key);
+    }
+    audit.record(AuditOp::Borrow, accounts[uid].id, key, remaining);
+    return BorrowResult::Borrowed;
+}
+
+// Queue a hold on a title; null if the title is gone. A copy that came
+// back since the stock check fills it before this returns, and the
+// caller reports that itself. minutes is clamped to [0, MAX_MINUTES].
+HoldQueue::Hold Library::placeHold(int uid, const string &title, int minutes)
+{
+    TRACE_SPAN("placeHold");
+    metrics::Operation::Scope metered(placeHoldOp);
+    minutes = clamp(minutes, 0, HoldQueue::MAX_MINUTES);
+    int     branchIdx = accounts[uid].branch;
+    Branch &br        = *branches[branchIdx];
+
+    br.booksLock.lockWrite();
+    BookRef b = br.catalog.latest().findByTitle(title);
+    if (!b)
+    {
+        br.booksLock.unlockWrite();
+        metered.error();
+        return nullptr;
+    }
+
+    int key  = makeBookKey(branchIdx, b.id());
+    auto hold = holds.place(uid, key, chrono::steady_clock::now() + chrono::minutes(minutes),
+                            accounts[uid].session);
+    audit.record(AuditOp::BorrowWait, accounts[uid].id, key, minutes);
+
+    serveHolds(branchIdx, b.id());
+    br.booksLock.unlockWrite();
+    if (hold->state.load() == BorrowResult::Borrowed)
+        holds.markReported(hold);
+    return hold;
+}
+
+// Hand freshly available copies of a book to its waiting holds (FIFO).
+// Caller holds the branch writer lock.
+void Library::serveHolds(int branchIdx, int bookId)
+{
+    TRACE_SPAN("serveHolds");
+    Branch &br  = *branches[branchIdx];
+    int     key = makeBookKey(branchIdx, bookId);
+
+    BookRef b = br.catalog.latest().findById(bookId);
+    if (!b || b.count() == 0)
+        return;
+
+    int            available = b.count();
+    bool           served    = false;
+    Catalog::Batch batch(br.catalog);
+
+    while (available > 0)
+    {
+        auto hold = holds.claimNext(key);
+        if (!hold)
+            break;
+
+        available = batch.adjustCount(bookId, -1);
+        served    = true;
+
+        topBorrowed.record(key);
+        {
+            lock_guard loans(loansMutex);
+            auto &loaned = accounts[hold->accountIdx].borrowedBookIds;
+            coBorrows.submit(key, loaned);
+            loaned.push_back(key);
+        }
+        audit.record(AuditOp::HoldFilled, accounts[hold->accountIdx].id, key, available);
+    }
+
+    if (served)
+        batch.publish();
+}
+
+// Return book
+void Library::returnBook()
+{
+    lock_guard io(io_mutex);
+
+    // remember who’s returning
+    int uid = currentUserIdx;
+
+    cout << "Title to return: " << flush;
+    string t; getline(cin, t);
+
+    int now = 0;
+    switch (returnCopy(uid, t, now))
+    {
+        case ReturnResult::Returned:
+            cout << "Returned '" << t << "'. Now: " << now << "\n" << flush;
+            break;
+        case ReturnResult::NotBorrowed:
+            // user never borrowed that title
+            cout << "You did not borrow that book, so it cannot be returned.\n" << flush;
+            break;
+        case ReturnResult::NotFound:
+            cout << "Book not found.\n";
+            suggestTitles(t);
+            break;
+    }
+}
+
+// Accept a copy back; waiting holds are served before the lock is released,
+// so `now` is the count left on the shelf afterwards
+ReturnResult Library::returnCopy(int uid, const string &title, int &now)
+{
+    TRACE_SPAN("returnCopy");
+    metrics::Operation::Scope metered(returnOp);
+    int     branchIdx = accounts[uid].branch;
+    Branch &br        = *branches[branchIdx];
+
+    br.booksLock.lockWrite();
+    BookRef b = br.catalog.latest().findByTitle(title);
+
+    if (!b)
+    {
+        br.booksLock.unlockWrite();
+        metered.error();
+        return ReturnResult::NotFound;
+    }
+
+    int  bookId = b.id();
+    int  key    = makeBookKey(branchIdx, bookId);
+    bool had;
+    {
+        lock_guard loans(loansMutex);
+        auto &loaned = accounts[uid].borrowedBookIds;
+        auto it = find(loaned.begin(), loaned.end(), key);
+        had = it != loaned.end();
+        if (had)
+            loaned.erase(it);
+    }
+
+    if (!had)
+    {
+        br.booksLock.unlockWrite();
+        audit.record(AuditOp::ReturnRejected, accounts[uid].id, key);
+        metered.error();
+        return ReturnResult::NotBorrowed;
+    }
+
+    Catalog::Batch batch(br.catalog);
+    int count = batch.adjustCount(bookId, +1);
+    batch.publish();
+    audit.record(AuditOp::Return, accounts[uid].id, key, count);
+
+    serveHolds(branchIdx, bookId);
+    now = br.catalog.latest().findById(bookId).count();
+    br.booksLock.unlockWrite();
+    return ReturnResult::Returned;
+}
+
+// Check availability
+void Library::checkAvailability()
+{
+    lock_guard io(io_mutex);
+
+    cout << "Title to check: " << flush;
+    string t; getline(cin, t);
+
+    int n = availableCopies(currentUserIdx, t);
+    if (n >= 0)
+    {
+        cout << n << " copies available.\n" << flush;
+    }
+    else
+    {
+        cout << "Book not found.\n";
+        suggestTitles(t);
+    }
+}
+
+// Copies on the shelf at the account's branch, or -1 for an unknown title
+int Library::availableCopies(int uid, const string &title)
+{
+    TRACE_SPAN("availableCopies");
+    metrics::Operation::Scope metered(availableOp);
+    Catalog::ReadView view(branches[accounts[uid].branch]->catalog);
+    BookRef b = view->findByTitle(title);
+    if (!b)
+        metered.error();
+    return b ? b.count() : -1;
+}
+
+// Patrons who borrowed this title also borrowed...
+void Library::recommendBooks()
+{
+    lock_guard io(io_mutex);
+    Branch &br = currentBranch();
+
+    cout << "Title you liked: " << flush;
+    string t; getline(cin, t);
+
+    Catalog::ReadView view(br.catalog);
+    BookRef b = view->findByTitle(t);
+
+    if (!b)
+    {
+        cout << "Book not found.\n" << flush;
+        return;
+    }
+
+    auto related = coBorrows.neighbors(makeBookKey(accounts[currentUserIdx].branch, b.id()));
+    if (related.empty())
+    {
+        cout << "No recommendations yet.\n" << flush;
+    }
+    else
+    {
+        cout << "Patrons who borrowed '" << t << "' also borrowed:\n";
+        for (auto &r : related)
+            cout << "- " << describeKey(r.first) << " (" << r.second << ")\n";
+        cout << flush;
+    }
+}
+
+// All titles by one author
+void Library::listBooksByAuthor()
+{
+    lock_guard io(io_mutex);
+    Branch &br = currentBranch();
+
+    cout << "Author: " << flush;
+    string a; getline(cin, a);
+
+    uint32_t authorId;
+    if (!br.catalog.authorTable().lookup(a, authorId))
+    {
+        cout << "No books by that author.\n" << flush;
+        return;
+    }
+
+    Catalog::ReadView  view(br.catalog);
+    const AuthorEntry *entry = view->authorEntry(authorId);
+    if (!entry || !entry->bookIds || entry->bookIds->empty())
+    {
+        cout << "No books by that author.\n" << flush;
+        return;
+    }
+
+    view->forEachByAuthor(authorId, [&](BookRef b)
+    {
+        cout << "- " << b.title() << " (" << b.count() << " available)\n";
+    });
+    cout << entry->bookIds->size() << " title(s), "
+         << entry->copies << " copies available in total.\n" << flush;
+}
+
+// Offer close matches after an exact title lookup failed (io_mutex held)
+void Library::suggestTitles(const string &title)
+{
+    Branch &br = currentBranch();
+    Catalog::ReadView view(br.catalog);
+    auto matches = br.titleIndex.search(title, *view);
+
+    if (!matches.empty())
+    {
+        cout << "Did you mean:\n";
+        for (auto &m : matches)
+        {
+            BookRef b = view->findById(m.id);
+            cout << "- " << b.title() << " by " << b.author() << "\n";
+        }
+    }
+    cout << flush;
+}
+
+// Lock status
+void Library::displayLockStatus()
+{
+    Branch &br = currentBranch();
+    if (br.booksLock.tryLockWrite())
+    {
+        br.booksLock.unlockWrite();
+        lock_guard io(io_mutex);
+        cout << "Write lock for branch " << br.name << " is free.\n" << flush;
+    }
+    else	
+    {
+        lock_guard io(io_mutex);
+        cout << "Write lock for branch " << br.name << " is held.\n" << flush;
+    }
+
+    lock_guard io(io_mutex);
+    cout << "\nLock waits:\n";
+    metrics::writeLockTable(cout);
+    cout << "\nOperations:\n";
+    metrics::writeOperationTable(cout);
+    cout << flush;
+}
+
+// Deadlock stub
+void Library::detectDeadlocks()
+{
+    lock_guard io(io_mutex);
+    cout << "No deadlocks detected.\n" << flush;
+}
+
+// Fairness stub
+void Library::ensureFairness()
+{
+    lock_guard io(io_mutex);
+    cout << "Fairness ensured (no starvation).\n" << flush;
+}
+
+// Most borrowed and most requested out-of-stock titles
+void Library::displayBorrowStats()
+{
+    auto borrowed = topBorrowed.top();
+    auto waited   = topOutOfStock.top();
+
+    lock_guard io(io_mutex);
+
+    constexpr int T_W = 60, N_W = 8;
+    auto printTable = [&](const char *heading, const vector<pair<int, uint32_t>> &rows)
+    {
+        cout << heading << "\n";
+        if (rows.empty())
+        {
+            cout << "  (no data yet)\n";
+            return;
+        }
+        cout << left << setw(T_W) << "Title" << setw(N_W) << "~Count" << "\n";
+        cout << string(T_W + N_W, '-') << "\n";
+        for (auto &r : rows)
+        {
+            cout << left
+                 << setw(T_W) << describeKey(r.first)
+                 << setw(N_W) << r.second << "\n";
+        }
+    };
+
+    printTable("Most borrowed titles:", borrowed);
+    cout << "\n";
+    printTable("Most requested out-of-stock titles:", waited);
+    cout << flush;
+}
+
+// Open a new branch with an empty catalog
+void Library::addBranch()
+{
+    lock_guard io(io_mutex);
+
+    cout << "Branch name: " << flush;
+    string name; getline(cin, name);
+
+    int n = openBranch(currentUserIdx, name);
+    if (n == -1)
+        cout << "Branch name is empty or already in use.\n" << flush;
+    else if (n == -2)
+        cout << "Branch limit reached.\n" << flush;
+    else
+        cout << "Branch '" << name << "' opened.\n" << flush;
+}
+
+// Index of the new branch; -1 for a bad or taken name, -2 at the limit
+int Library::openBranch(int uid, const string &name)
+{
+    TRACE_SPAN("openBranch");
+    lock_guard<mutex> lk(branchMutex);
+    int n = branchCount.load(memory_order_relaxed);
+    if (name.empty() || findBranch(name) >= 0)
+        return -1;
+    if (n == MAX_BRANCHES)
+        return -2;
+
+    branches[n] = make_unique<Branch>(name);
+    branchCount.store(n + 1, memory_order_release);
+    audit.record(AuditOp::AddBranch, accounts[uid].id, 0, 0, n);
+    return n;
+}
+
+// Choose which branch this session works at
+void Library::switchBranch()
+{
+    lock_guard io(io_mutex);
+
+    int n = branchCount.load(memory_order_acquire);
+    cout << "Branches:";
+    for (int i = 0; i < n; ++i)
+        cout << " " << branches[i]->name;
+    cout << "\nSwitch to: " << flush;
+    string name; getline(cin, name);
 
-    booksLock.lockWrite();
-    int idx = findBookIndex(t);
-    if (idx < 0)
+    if (!selectBranch(currentUserIdx, name))
     {
-        cout << "Book not found.\n" << flush;
-        booksLock.unlockWrite();
+        cout << "No such branch.\n" << flush;
         return;
     }
 
-    books.erase(books.begin() + idx);
-    booksLock.unlockWrite();
-
-    cout << "Book removed.\n" << flush;
+    cout << "Now working at " << name << ".\n" << flush;
 }
 
-// Borrow book
-void Library::borrowBook()
+bool Library::selectBranch(int uid, const string &name)
 {
-    lock_guard<mutex> io(io_mutex);
+    TRACE_SPAN("selectBranch");
+    int b = findBranch(name);
+    if (b < 0)
+        return false;
 
-    // remember who’s borrowing
-    int uid = currentUserIdx;
+    accounts[uid].branch = b;
+    return true;
+}
 
-    cout << "Title to borrow: " << flush;
+// Move copies of a title from the current branch to another one.
+// Both writer locks are taken in branch order, and both new versions are
+// published inside one transferSeq window, so cross-branch readers never
+// see the copies in both places or in neither.
+void Library::transferCopies()
+{
+    TRACE_SPAN("transferCopies");
+    lock_guard io(io_mutex);
+    int fromIdx = accounts[currentUserIdx].branch;
+
+    cout << "Title to transfer: " << flush;
     string t; getline(cin, t);
 
-    if (!booksLock.tryLockWrite())
+    cout << "Destination branch: " << flush;
+    string dest; getline(cin, dest);
+
+    cout << "Copies: " << flush;
+    int n; cin >> n;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+    int toIdx = findBranch(dest);
+    if (toIdx < 0 || toIdx == fromIdx || n <= 0)
     {
-        cout << "Library busy. Try later.\n" << flush;
+        cout << "Invalid destination or copy count.\n" << flush;
         return;
     }
 
-    int idx = findBookIndex(t);
-    if (idx < 0)
+    Branch &from = *branches[fromIdx];
+    Branch &to   = *branches[toIdx];
+    Branch &lo   = fromIdx < toIdx ? from : to;
+    Branch &hi   = fromIdx < toIdx ? to : from;
+
+    lo.booksLock.lockWrite();
+    hi.booksLock.lockWrite();
+
+    BookRef src = from.catalog.latest().findByTitle(t);
+    if (!src || src.count() < n)
     {
-        cout << "Book not found.\n" << flush;
-        booksLock.unlockWrite();
+        hi.booksLock.unlockWrite();
+        lo.booksLock.unlockWrite();
+        cout << (src ? "Not enough copies on hand.\n" : "Book not found.\n") << flush;
         return;
     }
 
-    if (books[idx].count == 0)
-    {
-        cout << "Out of stock. Waiting...\n" << flush;
-        booksLock.unlockWrite();
+    int     srcId  = src.id();
+    string  author = src.author();
+    BookRef dst    = to.catalog.latest().findByTitle(t, author);
+    int     dstId  = dst ? dst.id() : 0;
 
-        unique_lock<mutex> lk(cvMutex);
-        bookCv.wait(lk, [&]() {
-            booksLock.lockRead();
-            bool ok = (findBookIndex(t) >= 0 && books[findBookIndex(t)].count > 0);
-            booksLock.unlockRead();
-            return ok;
-        });
+    Catalog::Batch out(from.catalog);
+    Catalog::Batch in(to.catalog);
+    int left = out.adjustCount(srcId, -n);
+    if (dstId)
+        in.adjustCount(dstId, n);
+    else
+        dstId = in.append(t, author, n);
 
-        booksLock.lockWrite();
-        idx = findBookIndex(t);
-    }
+    transferSeq.fetch_add(1, memory_order_acq_rel);
+    out.publish();
+    in.publish();
+    transferSeq.fetch_add(1, memory_order_release);
 
-    if (idx >= 0 && books[idx].count > 0)
-    {
-        --books[idx].count;
+    if (!dst)
+        to.titleIndex.add(dstId, t);
+    serveHolds(toIdx, dstId);
 
-        // record it on the user’s account
-        accounts[uid].borrowedBookIds.push_back(books[idx].id);
+    hi.booksLock.unlockWrite();
+    lo.booksLock.unlockWrite();
 
-        cout << "Borrowed '" << t << "'. Remaining: " << books[idx].count << "\n" << flush;
-    }
-    else
-    {
-        cout << "Still unavailable.\n" << flush;
-    }
+    audit.record(AuditOp::Transfer, accounts[currentUserIdx].id,
+                 makeBookKey(fromIdx, srcId), n, toIdx);
 
-    booksLock.unlockWrite();
+    cout << "Moved " << n << " copies of '" << t << "' to " << to.name
+         << ". Left here: " << left << "\n" << flush;
 }
 
-// Return book
-void Library::returnBook()
+// Availability of a title at every branch. Branches are scanned in turn,
+// each against its own snapshot (one title lookup is far cheaper than
+// handing it to another thread); the merged result is retried if a
+// transfer published in between.
+void Library::checkAllBranches()
 {
-    lock_guard<mutex> io(io_mutex);
-
-    // remember who’s returning
-    int uid = currentUserIdx;
+    TRACE_SPAN("checkAllBranches");
+    lock_guard io(io_mutex);
 
-    cout << "Title to return: " << flush;
+    cout << "Title to check: " << flush;
     string t; getline(cin, t);
 
-    booksLock.lockWrite();
-    int idx = findBookIndex(t);
-
-    if (idx < 0)
+    auto countAt = [&](int i)
     {
-        cout << "Book not found.\n" << flush;
-        booksLock.unlockWrite();
-        return;
-    }
-
-    int bookId = books[idx].id;
-    auto &loaned = accounts[uid].borrowedBookIds;
-    auto it = find(loaned.begin(), loaned.end(), bookId);
+        Catalog::ReadView view(branches[i]->catalog);
+        BookRef b = view->findByTitle(t);
+        return b ? b.count() : -1;
+    };
 
-    if (it != loaned.end())
+    int         n = branchCount.load(memory_order_acquire);
+    vector<int> counts(n);
+    while (true)
     {
-        // user did borrow it: accept the return
-        ++books[idx].count;
-        loaned.erase(it);
+        uint64_t before = transferSeq.load(memory_order_acquire);
+        if (before & 1)
+        {
+            this_thread::yield();
+            continue;
+        }
 
-        cout << "Returned '" << t << "'. Now: " << books[idx].count << "\n" << flush;
+        for (int i = 0; i < n; ++i)
+            counts[i] = countAt(i);
+
+        atomic_thread_fence(memory_order_acquire);
+        if (transferSeq.load(memory_order_relaxed) == before)
+            break;
     }
-    else
+
+    long total   = 0;
+    bool carried = false;
+    for (int i = 0; i < n; ++i)
     {
-        // user never borrowed that title
-        cout << "You did not borrow that book, so it cannot be returned.\n" << flush;
+        if (counts[i] < 0)
+            continue;
+        cout << left << setw(20) << branches[i]->name << counts[i] << " available\n";
+        total  += counts[i];
+        carried = true;
     }
 
-    booksLock.unlockWrite();
-    bookCv.notify_all();
+    if (carried)
+        cout << "Total: " << total << "\n" << flush;
+    else
+        cout << "No branch carries that title.\n" << flush;
 }
 
-// Check availability
-void Library::checkAvailability()
+// Recent audit events, oldest first
+void Library::displayAuditTail()
 {
-    lock_guard<mutex> io(io_mutex);
-
-    cout << "Title to check: " << flush;
-    string t; getline(cin, t);
-
-    booksLock.lockRead();
-    int idx = findBookIndex(t);
+    auto events = audit.tail(20);
 
-    if (idx >= 0)
-        cout << books[idx].count << " copies available.\n" << flush;
-    else
-        cout << "Book not found.\n" << flush;
+    lock_guard io(io_mutex);
+    if (events.empty())
+    {
+        cout << "No audit events yet.\n" << flush;
+        return;
+    }
 
-    booksLock.unlockRead();
+    for (auto &e : events)
+    {
+        time_t secs = static_cast<time_t>(e.timeNs / 1000000000ULL);
+        tm     local{};
+#ifdef _WIN32
+        localtime_s(&local, &secs);
+#else
+        localtime_r(&secs, &local);
+#endif
+        cout << put_time(&local, "%H:%M:%S") << '.' << setfill('0') << setw(3)
+             << (e.timeNs / 1000000ULL) % 1000 << setfill(' ') << "  "
+             << left << setw(16) << auditOpName(e.op)
+             << "user " << setw(4) << e.accountId;
+        if (e.bookKey != 0)
+            cout << describeKey(e.bookKey);
+        if (e.op == AuditOp::Transfer || e.op == AuditOp::AddBranch)
+            cout << " -> " << branches[e.branch]->name;
+        if (e.value != 0)
+            cout << " (" << e.value << ")";
+        cout << "\n";
+    }
+    if (audit.dropped() > 0)
+        cout << audit.dropped() << " event(s) dropped while the buffer was full.\n";
+    cout << flush;
 }
 
-// Lock status
-void Library::displayLockStatus()
+// Pending holds of the current user
+void Library::listHolds()
 {
-    if (booksLock.tryLockWrite())
+    auto mine = holds.pending(currentUserIdx);
+
+    lock_guard io(io_mutex);
+    if (mine.empty())
     {
-        booksLock.unlockWrite();
-        lock_guard<mutex> io(io_mutex);
-        cout << "Write lock is free.\n" << flush;
+        cout << "You have no pending holds.\n" << flush;
+        return;
     }
-    else	
+
+    auto now = chrono::steady_clock::now();
+    for (auto &h : mine)
     {
-        lock_guard<mutex> io(io_mutex);
-        cout << "Write lock is held.\n" << flush;
+        auto left = chrono::duration_cast<chrono::minutes>(h->deadline - now).count();
+        cout << "#" << h->ticket << "  " << describeKey(h->bookKey)
+             << "  (expires in " << max<long long>(0, left) << " min)\n";
     }
+    cout << flush;
 }
 
-// Deadlock stub
-void Library::detectDeadlocks()
+// Tell the user what happened to holds since the last menu
+void Library::reportFinishedHolds(int idx)
 {
-    lock_guard<mutex> io(io_mutex);
-    cout << "No deadlocks detected.\n" << flush;
+    auto done = holds.takeFinished(idx);
+    if (done.empty())
+        return;
+
+    lock_guard io(io_mutex);
+    for (auto &h : done)
+    {
+        cout << "Hold #" << h->ticket << " for " << describeKey(h->bookKey) << ": ";
+        switch (h->state.load())
+        {
+            case BorrowResult::Borrowed:  cout << "filled, the book is now on your account.\n"; break;
+            case BorrowResult::TimedOut:  cout << "expired.\n"; break;
+            case BorrowResult::Cancelled: cout << "cancelled.\n"; break;
+            default:                      cout << "closed.\n"; break;
+        }
+    }
+    cout << flush;
 }
 
-// Fairness stub
-void Library::ensureFairness()
+// Logout: cancel the session token and every hold it still has pending
+void Library::endSession(int idx)
 {
-    lock_guard<mutex> io(io_mutex);
-    cout << "Fairness ensured (no starvation).\n" << flush;
+    TRACE_SPAN("endSession");
+    {
+        lock_guard lk(accountMutex);
+        accounts[idx].loggedIn = false;
+        if (accounts[idx].session)
+            accounts[idx].session->cancelled.store(true);
+    }
+
+    for (auto &h : holds.cancelAll(idx))
+        audit.record(AuditOp::HoldCancelled, accounts[idx].id, h->bookKey);
+
+    audit.record(AuditOp::Logout, accounts[idx].id);
 }
 
 // User session loop
@@ -606,7 +3083,7 @@ void Library::userSession(int idx)
         if (accounts[idx].isAdmin)
         {
             {
-                lock_guard<mutex> io(io_mutex);
+                lock_guard io(io_mutex);
                 cout << "\nAdmin Menu:\n"
                      << "1) Add Book\n"
                      << "2) Update Book\n"
@@ -615,7 +3092,12 @@ void Library::userSession(int idx)
                      << "5) Lock Status\n"
                      << "6) Deadlock Info\n"
                      << "7) Fairness Info\n"
-                     << "8) Logout\n";
+                     << "8) Borrow Statistics\n"
+                     << "9) Add Branch\n"
+                     << "10) Switch Branch\n"
+                     << "11) Transfer Copies\n"
+                     << "12) Audit Tail\n"
+                     << "13) Logout\n";
             }
 
             int choice = getMenuChoice();
@@ -658,9 +3140,34 @@ void Library::userSession(int idx)
                 }
                 case 8:
                 {
-                    accounts[idx].loggedIn = false;
+                    displayBorrowStats();
+                    break;
+                }
+                case 9:
+                {
+                    addBranch();
+                    break;
+                }
+                case 10:
+                {
+                    switchBranch();
+                    break;
+                }
+                case 11:
+                {
+                    transferCopies();
+                    break;
+                }
+                case 12:
+                {
+                    displayAuditTail();
+                    break;
+                }
+                case 13:
+                {
+                    endSession(idx);
                     {
-                        lock_guard<mutex> io2(io_mutex);
+                        lock_guard io2(io_mutex);
                         cout << "Logged out.\n" << flush;
                     }
                     break;
@@ -668,7 +3175,7 @@ void Library::userSession(int idx)
                 default:
                 {
                     {
-                        lock_guard<mutex> io2(io_mutex);
+                        lock_guard io2(io_mutex);
                         cout << "Invalid option.\n" << flush;
                     }
                     break;
@@ -677,13 +3184,19 @@ void Library::userSession(int idx)
         }
         else
         {
+            reportFinishedHolds(idx);
             {
-                lock_guard<mutex> io(io_mutex);
+                lock_guard io(io_mutex);
                 cout << "\nUser Menu:\n"
                      << "1) Borrow Book\n"
                      << "2) Return Book\n"
                      << "3) Check Availability\n"
-                     << "4) Logout\n";
+                     << "4) Recommendations\n"
+                     << "5) Books by Author\n"
+                     << "6) All Branches Availability\n"
+                     << "7) Switch Branch\n"
+                     << "8) My Holds\n"
+                     << "9) Logout\n";
             }
 
             int choice = getMenuChoice();
@@ -706,9 +3219,34 @@ void Library::userSession(int idx)
                 }
                 case 4:
                 {
-                    accounts[idx].loggedIn = false;
+                    recommendBooks();
+                    break;
+                }
+                case 5:
+                {
+                    listBooksByAuthor();
+                    break;
+                }
+                case 6:
+                {
+                    checkAllBranches();
+                    break;
+                }
+                case 7:
+                {
+                    switchBranch();
+                    break;
+                }
+                case 8:
+                {
+                    listHolds();
+                    break;
+                }
+                case 9:
+                {
+                    endSession(idx);
                     {
-                        lock_guard<mutex> io2(io_mutex);
+                        lock_guard io2(io_mutex);
                         cout << "Logged out.\n" << flush;
                     }
                     break;
@@ -716,7 +3254,7 @@ void Library::userSession(int idx)
                 default:
                 {
                     {
-                        lock_guard<mutex> io2(io_mutex);
+                        lock_guard io2(io_mutex);
                         cout << "Invalid option.\n" << flush;
                     }
                     break;
@@ -726,24 +3264,479 @@ void Library::userSession(int idx)
 
         // Pause before clearing
         {
-            lock_guard<mutex> io(io_mutex);
+            lock_guard io(io_mutex);
             cout << "Press Enter to continue..." << flush;
         }
         cin.get();
     }
 }
 
+// One line of a replay script:
+//   <ms> <session> <op> [arg | arg | ...]
+// Sessions are free-form names; blank lines and '#' comments are skipped.
+struct ReplayStep
+{
+    long long      atMs;
+    string         session;
+    string         op;
+    vector<string> args;
+    int            line;
+};
+
+// Latencies of one operation name, merged across sessions
+struct ReplayOpStats
+{
+    vector<long long> latencyNs;
+    long long         failed = 0;
+};
+
+static bool parseReplayScript(const string &path, vector<ReplayStep> &steps)
+{
+    // op -> number of '|' separated arguments it needs
+    static const unordered_map<string, int> arity = {
+        {"register", 4}, {"login", 2}, {"logout", 0}, {"borrow", 1}, {"return", 1},
+        {"check", 1}, {"add", 3}, {"remove", 1}, {"branch", 1}, {"switch", 1}
+    };
+
+    ifstream in(path);
+    if (!in)
+    {
+        cout << "Cannot open replay script '" << path << "'.\n";
+        return false;
+    }
+
+    auto trim = [](string v)
+    {
+        size_t b = v.find_first_not_of(" \t\r");
+        size_t e = v.find_last_not_of(" \t\r");
+        return b == string::npos ? string() : v.substr(b, e - b + 1);
+    };
+
+    string text;
+    for (int line = 1; getline(in, text); ++line)
+    {
+        text = trim(text);
+        if (text.empty() || text[0] == '#')
+            continue;
+
+        ReplayStep step{0, "", "", {}, line};
+        stringstream ss(text);
+        if (!(ss >> step.atMs >> step.session >> step.op))
+        {
+            cout << path << ":" << line << ": expected '<ms> <session> <op> [args]'.\n";
+            return false;
+        }
+
+        string rest;
+        getline(ss, rest);
+        rest = trim(rest);
+        if (!rest.empty())
+        {
+            stringstream fields(rest);
+            string       field;
+            while (getline(fields, field, '|'))
+                step.args.push_back(trim(field));
+        }
+
+        auto it = arity.find(step.op);
+        if (it == arity.end())
+        {
+            cout << path << ":" << line << ": unknown op '" << step.op << "'.\n";
+            return false;
+        }
+        // borrow takes an optional hold time in minutes
+        size_t want = it->second;
+        if (step.args.size() != want && !(step.op == "borrow" && step.args.size() == 2))
+        {
+            cout << path << ":" << line << ": '" << step.op << "' takes " << want << " argument(s).\n";
+            return false;
+        }
+
+        steps.push_back(move(step));
+    }
+
+    stable_sort(steps.begin(), steps.end(),
+                [](const ReplayStep &a, const ReplayStep &b) { return a.atMs < b.atMs; });
+    return true;
+}
+
+// Headless replay of a recorded script. Every session runs on its own
+// thread against the core operations, either back to back or at the
+// recorded offsets (--paced), then throughput and per-op latency
+// percentiles are printed. Registrations run first, before the clock
+// starts, so the account table never grows under running sessions.
+int Library::replay(const string &path, bool paced)
+{
+    vector<ReplayStep> steps;
+    if (!parseReplayScript(path, steps))
+        return 1;
+
+    vector<string>                                    order;
+    unordered_map<string, vector<const ReplayStep *>> bySession;
+    for (auto &step : steps)
+    {
+        if (step.op == "register")
+        {
+            const string &pwd = step.args[3];
+            lock_guard lk(accountMutex);
+            if (validPassword(pwd))
+                createAccount(step.args[0], step.args[1], step.args[2], pwd);
+            else
+                cout << path << ":" << step.line << ": weak password, account skipped.\n";
+            continue;
+        }
+
+        auto &mine = bySession[step.session];
+        if (mine.empty())
+            order.push_back(step.session);
+        mine.push_back(&step);
+    }
+
+    size_t sessions = order.size();
+    vector<unordered_map<string, ReplayOpStats>> perSession(sessions);
+    vector<long long>                            maxLagNs(sessions, 0);
+
+    auto start = chrono::steady_clock::now();
+
+    auto runSession = [&](size_t s)
+    {
+        TRACE_THREAD_NAME("replay session");
+        auto &stats = perSession[s];
+        int   uid   = -1;
+
+        for (const ReplayStep *step : bySession[order[s]])
+        {
+            const auto &a = step->args;
+
+            if (paced)
+            {
+                auto due = start + chrono::milliseconds(step->atMs);
+                this_thread::sleep_until(due);
+                maxLagNs[s] = max<long long>(maxLagNs[s],
+                    chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - due).count());
+            }
+
+            auto t0 = chrono::steady_clock::now();
+            bool ok = false;
+
+            if (step->op == "login")
+            {
+                if (uid >= 0)
+                    endSession(uid);
+                uid = authenticate(a[0], a[1]);
+                ok  = uid >= 0;
+            }
+            else if (uid < 0)
+            {
+                ok = false;   // every other op needs a session
+            }
+            else if (step->op == "logout")
+            {
+                endSession(uid);
+                uid = -1;
+                ok  = true;
+            }
+            else if (step->op == "borrow")
+            {
+                int remaining = 0;
+                auto r = borrowCopy(uid, a[0], remaining);
+                ok = r == BorrowResult::Borrowed;
+                if (r == BorrowResult::OutOfStock && a.size() == 2 && atoi(a[1].c_str()) > 0)
+                    ok = placeHold(uid, a[0], atoi(a[1].c_str())) != nullptr;
+            }
+            else if (step->op == "return")
+            {
+                int now = 0;
+                ok = returnCopy(uid, a[0], now) == ReturnResult::Returned;
+            }
+            else if (step->op == "check")
+            {
+                ok = availableCopies(uid, a[0]) >= 0;
+            }
+            else if (step->op == "switch")
+            {
+                ok = selectBranch(uid, a[0]);
+            }
+            else if (!accounts[uid].isAdmin)
+            {
+                ok = false;   // add, remove and branch are admin operations
+            }
+            else if (step->op == "add")
+            {
+                addTitle(uid, a[0], a[1], atoi(a[2].c_str()));
+                ok = true;
+            }
+            else if (step->op == "remove")
+            {
+                ok = removeTitle(uid, a[0]);
+            }
+            else if (step->op == "branch")
+            {
+                ok = openBranch(uid, a[0]) >= 0;
+            }
+
+            auto &op = stats[step->op];
+            op.latencyNs.push_back(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0).count());
+            if (!ok)
+                ++op.failed;
+        }
+
+        if (uid >= 0)
+            endSession(uid);
+    };
+
+    vector<thread> workers;
+    workers.reserve(sessions);
+    for (size_t s = 0; s < sessions; ++s)
+        workers.emplace_back(runSession, s);
+    for (auto &w : workers)
+        w.join();
+
+    double wallMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    map<string, ReplayOpStats> merged;
+    long long total = 0, failed = 0;
+    for (auto &stats : perSession)
+        for (auto &[name, op] : stats)
+        {
+            auto &m = merged[name];
+            m.latencyNs.insert(m.latencyNs.end(), op.latencyNs.begin(), op.latencyNs.end());
+            m.failed += op.failed;
+            total    += op.latencyNs.size();
+            failed   += op.failed;
+        }
+
+    cout << "Replayed " << total << " ops from " << sessions << " session(s) in "
+         << fixed << setprecision(1) << wallMs << " ms ("
+         << (paced ? "paced" : "as fast as possible") << ")\n";
+    cout << "Throughput: " << setprecision(0) << (wallMs > 0 ? total * 1000.0 / wallMs : 0.0)
+         << " ops/s, " << failed << " failed\n";
+    if (paced)
+        cout << "Worst start lag: " << setprecision(3)
+             << *max_element(maxLagNs.begin(), maxLagNs.end()) / 1e6 << " ms\n";
+
+    constexpr int OP_W = 10, N_W = 9, US_W = 11;
+    cout << "\n" << left << setw(OP_W) << "Op" << right
+         << setw(N_W) << "Count" << setw(N_W) << "Failed"
+         << setw(US_W) << "p50 us" << setw(US_W) << "p95 us"
+         << setw(US_W) << "p99 us" << setw(US_W) << "max us" << "\n";
+    cout << string(OP_W + 2 * N_W + 4 * US_W, '-') << "\n" << setprecision(1);
+
+    for (auto &[name, op] : merged)
+    {
+        auto &lat = op.latencyNs;
+        sort(lat.begin(), lat.end());
+        auto pct = [&](double q) { return lat[min(lat.size() - 1, size_t(q * lat.size()))] / 1e3; };
+
+        cout << left << setw(OP_W) << name << right
+             << setw(N_W) << lat.size() << setw(N_W) << op.failed
+             << setw(US_W) << pct(0.50) << setw(US_W) << pct(0.95)
+             << setw(US_W) << pct(0.99) << setw(US_W) << lat.back() / 1e3 << "\n";
+    }
+    cout << flush;
+    return 0;
+}
+
+// Explore schedules of a borrow/return workload under the deterministic
+// scheduler: three patrons share two scarce titles while an admin edits
+// the catalog. Each schedule gets a fresh Library and seed firstSeed+k.
+// A schedule fails on deadlock or when copies or loans do not add up
+// afterwards; "busy" answers from tryLockWrite are counted separately.
+int Library::simulate(int schedules, uint64_t firstSeed, bool trace)
+{
+    constexpr int PATRONS = 3, ROUNDS = 4;
+
+    sim::OpStats     stats;
+    vector<uint64_t> makespans;
+    vector<uint64_t> busySeeds, failedSeeds;
+    uint64_t         worstSeed = firstSeed, worstTime = 0;
+
+    for (int k = 0; k < schedules; ++k)
+    {
+        uint64_t seed = firstSeed + k;
+        Library  lib("");
+        lib.addTitle(0, "Dune", "Frank Herbert", 2);
+        lib.addTitle(0, "Emma", "Jane Austen", 1);
+
+        vector<int> patrons;
+        for (int p = 0; p < PATRONS; ++p)
+        {
+            string last = "Patron" + to_string(p);
+            lib.createAccount("S", "I", last, "Passw0rd!");
+            patrons.push_back(lib.authenticate("SI" + last, "Passw0rd!"));
+        }
+
+        atomic<int>    busy{0};
+        sim::Scheduler sched(seed, trace);
+
+        auto timed = [&](const char *op, auto &&call)
+        {
+            uint64_t t0 = sim::nowNs();
+            auto     r  = call();
+            stats.record(op, sim::nowNs() - t0);
+            return r;
+        };
+
+        for (int p = 0; p < PATRONS; ++p)
+        {
+            int uid = patrons[p];
+            sched.spawn("patron" + to_string(p), [&, uid]()
+            {
+                for (int round = 0; round < ROUNDS; ++round)
+                {
+                    for (const char *title : {"Dune", "Emma"})
+                    {
+                        int  left = 0, now = 0;
+                        auto r    = timed("borrow", [&]() { return lib.borrowCopy(uid, title, left); });
+                        if (r == BorrowResult::Busy)
+                            ++busy;
+                        if (r != BorrowResult::Borrowed)
+                            continue;
+
+                        sim::sleepFor(chrono::milliseconds(1));
+                        timed("return", [&]() { return lib.returnCopy(uid, title, now); });
+                    }
+                    timed("check", [&]() { return lib.availableCopies(uid, "Emma"); });
+                }
+            });
+        }
+
+        sched.spawn("admin", [&]()
+        {
+            for (int round = 0; round < ROUNDS; ++round)
+            {
+                string title = "Extra " + to_string(round);
+                timed("add", [&]() { return lib.addTitle(0, title, "Anon", 1); });
+                sim::sleepFor(chrono::microseconds(500));
+                timed("remove", [&]() { return lib.removeTitle(0, title); });
+            }
+        });
+
+        bool   ok = sched.run();
+        string problem = sched.failure();
+        if (ok)
+        {
+            Catalog::ReadView view(lib.branches[0]->catalog);
+            BookRef dune = view->findByTitle("Dune");
+            BookRef emma = view->findByTitle("Emma");
+            if (!dune || !emma || dune.count() != 2 || emma.count() != 1)
+                problem = "copies lost or duplicated";
+            for (int uid : patrons)
+                if (!lib.accounts[uid].borrowedBookIds.empty())
+                    problem = "loan left on " + lib.accounts[uid].username;
+        }
+
+        makespans.push_back(sched.now());
+        if (sched.now() > worstTime)
+        {
+            worstTime = sched.now();
+            worstSeed = seed;
+        }
+        if (busy > 0)
+            busySeeds.push_back(seed);
+        if (!problem.empty())
+        {
+            failedSeeds.push_back(seed);
+            cout << "Seed " << seed << ": " << problem << "\n";
+        }
+
+        if (schedules == 1 && trace)
+        {
+            cout << "Schedule trace (seed " << seed << "):\n";
+            for (auto &line : sched.trace())
+                cout << line << "\n";
+        }
+    }
+
+    sort(makespans.begin(), makespans.end());
+    cout << "\nSimulated " << schedules << " schedule(s) from seed " << firstSeed << "\n"
+         << fixed << setprecision(3)
+         << "Virtual makespan (ms): min " << makespans.front() / 1e6
+         << ", median " << makespans[makespans.size() / 2] / 1e6
+         << ", max " << makespans.back() / 1e6 << " (seed " << worstSeed << ")\n"
+         << "Schedules with busy borrows: " << busySeeds.size();
+    if (!busySeeds.empty())
+        cout << " (first seed " << busySeeds.front() << ")";
+    cout << "\nFailed schedules: " << failedSeeds.size();
+    if (!failedSeeds.empty())
+        cout << " (first seed " << failedSeeds.front() << ")";
+    cout << "\n\nVirtual latency per operation:\n";
+    stats.print(cout);
+    cout << "Replay one schedule with: --simulate 1 --sim-seed <seed> --sim-trace\n" << flush;
+    return failedSeeds.empty() ? 0 : 1;
+}
+
 // Main Program
-int main()
+int main(int argc, char *argv[])
 {
-    Library lib;
+    // Deterministic schedule exploration: --simulate <n> [--sim-seed <s>] [--sim-trace]
+    // Headless replay: --replay <script> [--paced]
+    // Span tracing: --trace <file> (builds with -DENABLE_TRACING)
+    // Metrics: --metrics-file <file> and/or --metrics-port <port>, Prometheus text,
+    // the file rewritten every --metrics-interval <seconds> (default 5)
+    int      schedules = 0;
+    uint64_t seed      = 1;
+    bool     trace     = false;
+    string   tracePath = "library.trace.json";
+    bool     traceRequested = false;
+    string   metricsPath;
+    int      metricsPort     = 0;
+    int      metricsInterval = 5;
+    string   replayPath;
+    bool     paced = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--replay" && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (arg == "--paced")
+            paced = true;
+        else if (arg == "--simulate" && i + 1 < argc)
+            schedules = atoi(argv[++i]);
+        else if (arg == "--sim-seed" && i + 1 < argc)
+            seed = strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--sim-trace")
+            trace = true;
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            tracePath      = argv[++i];
+            traceRequested = true;
+        }
+        else if (arg == "--metrics-file" && i + 1 < argc)
+            metricsPath = argv[++i];
+        else if (arg == "--metrics-port" && i + 1 < argc)
+            metricsPort = atoi(argv[++i]);
+        else if (arg == "--metrics-interval" && i + 1 < argc)
+            metricsInterval = atoi(argv[++i]);
+    }
+    if (traceRequested && !trace::enabled)
+        cout << "Tracing is not compiled in; rebuild with -DENABLE_TRACING.\n";
+    trace::Session tracing(traceRequested ? tracePath : "");
+    TRACE_THREAD_NAME("main");
+
+    metrics::Registry::get().setNamespace("library");
+    metrics::Exporter exporter(metricsPath, metricsPort, chrono::seconds(max(1, metricsInterval)));
+    if (!exporter.start())
+        cout << "Could not serve metrics on port " << metricsPort << ".\n";
+    else if (metricsPort > 0)
+        cout << "Metrics at http://127.0.0.1:" << metricsPort << "/metrics\n";
+
+    if (schedules > 0)
+        return Library::simulate(schedules, seed, trace);
+
+    // Headless mode: --replay <script> [--paced], audited to its own file
+    Library lib(replayPath.empty() ? "library_audit.log" : "library_replay_audit.log");
+
+    if (!replayPath.empty())
+        return lib.replay(replayPath, paced);
 
     while (true)
     {
         clearScreen();
 
         {
-            lock_guard<mutex> io(io_mutex);
+            lock_guard io(io_mutex);
             cout << "\nMenu:\n"
                  << "1) Register\n"
                  << "2) Login\n"
@@ -768,18 +3761,18 @@ int main()
         }
         else
         {
-            lock_guard<mutex> io(io_mutex);
+            lock_guard io(io_mutex);
             cout << "Invalid choice.\n" << flush;
         }
 
         {
-            lock_guard<mutex> io(io_mutex);
+            lock_guard io(io_mutex);
             cout << "Press Enter to continue..." << flush;
         }
         cin.get();
     }
 
-    lock_guard<mutex> io(io_mutex);
+    lock_guard io(io_mutex);
     cout << "Shutting down...\n" << flush;
     return 0;
 }
@@ -0,0 +1,342 @@
+// Optional span tracing shared by both programs, exported as Chrome
+// trace-event JSON (open it in Perfetto or chrome://tracing).
+//
+// Build with -DENABLE_TRACING to record. Without it every macro below
+// expands to nothing and TRACE_LOCKABLE declares the plain lock type, so
+// untraced builds carry no cost at all.
+//
+//   TRACE_SPAN("registerPatient");          work span until the end of the scope
+//   TRACE_LOCKABLE(sim::Mutex, appMutex);   a lock whose waits and holds are spans
+//   TRACE_LOCKABLE_ARGS(T, var, args...);   the same for a lock constructed from args
+//   TRACE_THREAD_NAME("dispatcher");        label for the calling thread
+//   trace::Session tracing(path);           writes the trace file when destroyed ("" = never)
+//
+// Locks with their own acquire/release functions (like RWLock) use
+// TRACE_WAIT_BEGIN / TRACE_ACQUIRED / TRACE_RELEASED directly.
+//
+// Every thread records into its own ring of the most recent RING_SIZE
+// spans, timestamped with steady_clock. The ring's mutex is only ever
+// contended while a trace is being written.
+
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <string>
+
+#ifdef ENABLE_TRACING
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace trace
+{
+
+constexpr bool enabled = true;
+
+inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Span
+{
+    const char *name;   // string literals only; kept by pointer
+    const char *cat;
+    uint64_t    start;
+    uint64_t    end;
+};
+
+class Ring
+{
+public:
+    static constexpr size_t RING_SIZE = 16384;
+
+    explicit Ring(int tid) : tid(tid), spans(RING_SIZE) {}
+
+    void push(const Span &s)
+    {
+        std::lock_guard<std::mutex> lk(ringMutex);
+        spans[count++ % RING_SIZE] = s;
+    }
+
+    void setName(const std::string &n)
+    {
+        std::lock_guard<std::mutex> lk(ringMutex);
+        name = n;
+    }
+
+    // Oldest first
+    void copy(std::vector<Span> &out, std::string &threadName)
+    {
+        std::lock_guard<std::mutex> lk(ringMutex);
+        uint64_t first = count > RING_SIZE ? count - RING_SIZE : 0;
+        for (uint64_t i = first; i < count; ++i)
+            out.push_back(spans[i % RING_SIZE]);
+        threadName = name;
+    }
+
+    const int tid;
+
+private:
+    std::mutex        ringMutex;
+    std::vector<Span> spans;
+    uint64_t          count = 0;
+    std::string       name;
+};
+
+// Rings outlive their threads so short-lived threads still show up
+class Registry
+{
+public:
+    static Registry &get()
+    {
+        static Registry r;
+        return r;
+    }
+
+    std::shared_ptr<Ring> add()
+    {
+        std::lock_guard<std::mutex> lk(registryMutex);
+        rings.push_back(std::make_shared<Ring>(int(rings.size()) + 1));
+        return rings.back();
+    }
+
+    bool write(const std::string &path)
+    {
+        std::vector<std::shared_ptr<Ring>> all;
+        {
+            std::lock_guard<std::mutex> lk(registryMutex);
+            all = rings;
+        }
+        FILE *f = fopen(path.c_str(), "w");
+        if (!f)
+            return false;
+
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        for (auto &ring : all)
+        {
+            std::vector<Span> spans;
+            std::string       threadName;
+            ring->copy(spans, threadName);
+            if (threadName.empty())
+                threadName = "thread " + std::to_string(ring->tid);
+
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", ring->tid, escape(threadName).c_str());
+            first = false;
+            for (const Span &s : spans)
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        s.name, s.cat, ring->tid, s.start / 1e3, (s.end - s.start) / 1e3);
+        }
+        fprintf(f, "\n]}\n");
+        fclose(f);
+        return true;
+    }
+
+private:
+    static std::string escape(const std::string &s)
+    {
+        std::string out;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                out += c;
+        }
+        return out;
+    }
+
+    std::mutex                         registryMutex;
+    std::vector<std::shared_ptr<Ring>> rings;
+};
+
+inline Ring &localRing()
+{
+    thread_local std::shared_ptr<Ring> ring = Registry::get().add();
+    return *ring;
+}
+
+inline void record(const char *name, const char *cat, uint64_t start, uint64_t end)
+{
+    localRing().push({name, cat, start, end});
+}
+
+// Locks this thread currently holds, with the time each was taken
+struct Held
+{
+    const void *lock;
+    uint64_t    since;
+};
+
+inline std::vector<Held> &heldLocks()
+{
+    thread_local std::vector<Held> held;
+    return held;
+}
+
+// waitName may be null when nothing was waited for (a successful try_lock)
+inline void acquired(const void *lock, const char *waitName, uint64_t waitStart)
+{
+    uint64_t t = now();
+    if (waitName)
+        record(waitName, "lock", waitStart, t);
+    heldLocks().push_back({lock, t});
+}
+
+inline void released(const void *lock, const char *holdName)
+{
+    std::vector<Held> &held = heldLocks();
+    for (size_t i = held.size(); i-- > 0;)
+    {
+        if (held[i].lock == lock)
+        {
+            record(holdName, "lock", held[i].since, now());
+            held.erase(held.begin() + i);
+            return;
+        }
+    }
+}
+
+class ScopedSpan
+{
+public:
+    explicit ScopedSpan(const char *name) : name(name), start(now()) {}
+    ~ScopedSpan() { record(name, "op", start, now()); }
+
+    ScopedSpan(const ScopedSpan &) = delete;
+    ScopedSpan &operator=(const ScopedSpan &) = delete;
+
+private:
+    const char *name;
+    uint64_t    start;
+};
+
+// Any lockable (exclusive, and shared if M has it) reporting wait and hold spans
+template <class M>
+class Lockable
+{
+public:
+    template <class... Args>
+    Lockable(const char *waitName, const char *holdName, Args &&...args)
+        : m(std::forward<Args>(args)...), waitName(waitName), holdName(holdName)
+    {
+    }
+
+    void lock()
+    {
+        uint64_t t = now();
+        m.lock();
+        acquired(this, waitName, t);
+    }
+
+    bool try_lock()
+    {
+        if (!m.try_lock())
+            return false;
+        acquired(this, nullptr, 0);
+        return true;
+    }
+
+    void unlock()
+    {
+        released(this, holdName);
+        m.unlock();
+    }
+
+    void lock_shared()
+    {
+        uint64_t t = now();
+        m.lock_shared();
+        acquired(this, waitName, t);
+    }
+
+    bool try_lock_shared()
+    {
+        if (!m.try_lock_shared())
+            return false;
+        acquired(this, nullptr, 0);
+        return true;
+    }
+
+    void unlock_shared()
+    {
+        released(this, holdName);
+        m.unlock_shared();
+    }
+
+private:
+    M           m;
+    const char *waitName;
+    const char *holdName;
+};
+
+// Writes every thread's spans to `path` when it goes out of scope;
+// an empty path writes nothing
+class Session
+{
+public:
+    explicit Session(const std::string &path) : path(path) {}
+
+    ~Session()
+    {
+        if (path.empty())
+            return;
+        if (Registry::get().write(path))
+            fprintf(stderr, "Trace written to %s\n", path.c_str());
+        else
+            fprintf(stderr, "Could not write trace to %s\n", path.c_str());
+    }
+
+private:
+    std::string path;
+};
+
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+
+#define TRACE_SPAN(name)             trace::ScopedSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define TRACE_LOCKABLE(type, var)    trace::Lockable<type> var{"wait " #var, "hold " #var}
+#define TRACE_LOCKABLE_ARGS(type, var, ...) \
+    trace::Lockable<type> var{"wait " #var, "hold " #var, __VA_ARGS__}
+#define TRACE_THREAD_NAME(name)      trace::localRing().setName(name)
+#define TRACE_WAIT_BEGIN()           const uint64_t traceWaitStart = trace::now()
+#define TRACE_ACQUIRED(lock, name)   trace::acquired(lock, name, traceWaitStart)
+#define TRACE_TRY_ACQUIRED(lock)     trace::acquired(lock, nullptr, 0)
+#define TRACE_RELEASED(lock, name)   trace::released(lock, name)
+
+#else
+
+namespace trace
+{
+
+constexpr bool enabled = false;
+
+struct Session
+{
+    explicit Session(const std::string &) {}
+};
+
+} // namespace trace
+
+#define TRACE_SPAN(name)             ((void)0)
+#define TRACE_LOCKABLE(type, var)    type var
+#define TRACE_LOCKABLE_ARGS(type, var, ...) type var{__VA_ARGS__}
+#define TRACE_THREAD_NAME(name)      ((void)0)
+#define TRACE_WAIT_BEGIN()           ((void)0)
+#define TRACE_ACQUIRED(lock, name)   ((void)0)
+#define TRACE_TRY_ACQUIRED(lock)     ((void)0)
+#define TRACE_RELEASED(lock, name)   ((void)0)
+
+#endif // ENABLE_TRACING
+
+#endif // TRACING_H